@@ -0,0 +1,150 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#pragma once
+
+#include "RenderCache.h"
+#include "Utils.h"
+#include "CpuDispatch.h"
+#include "PixelArena.h"
+
+// Upper case letters get their own color class, everything else is a plain character.
+static inline void ClassifyCharacters(unsigned char* dest, const wchar_t* chars, int count)
+{
+	int i = 0;
+	if(g_cpuLevel >= CpuLevel_SSE2)
+	{
+		// Compare 8 characters at a time and narrow the 16 bit masks to bytes. ColorClass_UpperCase comes right
+		// before ColorClass_Character, so the mask only needs to be subtracted.
+		__m128i rangeStart = _mm_set1_epi16(L'A' - 1);
+		__m128i rangeEnd = _mm_set1_epi16(L'Z' + 1);
+		__m128i character = _mm_set1_epi8(ColorClass_Character);
+		__m128i one = _mm_set1_epi8(1);
+		for(; i + 8 <= count; i += 8)
+		{
+			__m128i chr = _mm_loadu_si128((const __m128i*)(chars + i));
+			__m128i isUpper = _mm_and_si128(_mm_cmpgt_epi16(chr, rangeStart), _mm_cmplt_epi16(chr, rangeEnd));
+			isUpper = _mm_packs_epi16(isUpper, isUpper);
+			__m128i colorClass = _mm_sub_epi8(character, _mm_and_si128(isUpper, one));
+			_mm_storel_epi64((__m128i*)(dest + i), colorClass);
+		}
+	}
+
+	for(; i < count; ++i)
+		dest[i] = ( (chars[i] >= L'A') && (chars[i] <= L'Z') ) ? ColorClass_UpperCase : ColorClass_Character;
+}
+
+// Paints a run of characters on a row of color classes, clipping it to the width of the bar.
+static inline void PaintColorClasses(unsigned char* row, unsigned int width, int column, const wchar_t* chars, int count, unsigned int flags)
+{
+	if(column >= (int)width)
+		return;
+
+	count = std::min(count, (int)width - column);
+	unsigned char* dest = row + column;
+	if(flags & TextFlag_Highlight)
+		memset(dest, ColorClass_Match + (flags >> TextFlag_SlotShift), count);
+	else if(flags & TextFlag_Comment)
+		memset(dest, ColorClass_Comment, count);
+	else
+		ClassifyCharacters(dest, chars, count);
+}
+
+static inline void PaintWhitespace(unsigned char* row, unsigned int width, int column, int count)
+{
+	if(column >= (int)width)
+		return;
+
+	count = std::min(count, (int)width - column);
+	memset(row + column, ColorClass_Whitespace, count);
+}
+
+// Guesses how many virtual lines a range of text renders to, so the image can be allocated in one go. Tabs make
+// it an underestimate at times, which only costs a reallocation.
+static inline int EstimateVirtualLines(int numLines, size_t numChars, int wrapAfter)
+{
+	if( (wrapAfter <= 0) || (wrapAfter == INT_MAX) )
+		return numLines;
+	return numLines + int(numChars / wrapAfter);
+}
+
+// Paints the full resolution code image of the bar, one color class per character. Every pixel of a row is written
+// before the next one is started, so the arena never has to clear anything.
+struct BarRenderOp
+{
+	BarRenderOp(PixelArena& _image, unsigned int _width) : image(_image), width(_width) {}
+
+	void Init(int numLines)
+	{
+		image.Reserve(numLines*width);
+		image.Resize(width);
+	}
+
+	void EndLine(int line, int lastColumn, unsigned int /*lineFlags*/, bool textEnd)
+	{
+		// Fill the remaining pixels with whitespace.
+		if(lastColumn < (int)width)
+			memset(image.GetData() + line*width + lastColumn, ColorClass_Whitespace, width - lastColumn);
+
+		if(!textEnd)
+		{
+			// Advance the image pointer.
+			image.Resize((line + 2) * width);
+		}
+	}
+
+	void RenderSpaces(int line, int column, int count)
+	{
+		PaintWhitespace(image.GetData() + line*width, width, column, count);
+	}
+
+	void RenderRun(int line, int column, const wchar_t* chars, int count, unsigned int flags)
+	{
+		PaintColorClasses(image.GetData() + line*width, width, column, chars, count, flags);
+	}
+
+	PixelArena& image;
+	unsigned int width;
+};
+
+// Paints one virtual line at a time and hands each finished line to the scaler, so the full resolution image is
+// never stored. The scaler must have been created for the exact number of virtual lines in the text.
+struct ScaledBarRenderOp
+{
+	ScaledBarRenderOp(PaletteScaler& _scaler, unsigned int _width) : scaler(_scaler), row(_width), width(_width) {}
+
+	void Init(int /*numLines*/) {}
+
+	void EndLine(int /*line*/, int lastColumn, unsigned int /*lineFlags*/, bool /*textEnd*/)
+	{
+		PaintWhitespace(&row[0], width, lastColumn, width);
+		scaler.AddRow(&row[0]);
+	}
+
+	void RenderSpaces(int /*line*/, int column, int count)
+	{
+		PaintWhitespace(&row[0], width, column, count);
+	}
+
+	void RenderRun(int /*line*/, int column, const wchar_t* chars, int count, unsigned int flags)
+	{
+		PaintColorClasses(&row[0], width, column, chars, count, flags);
+	}
+
+	PaletteScaler& scaler;
+	std::vector<unsigned char> row;
+	unsigned int width;
+};
@@ -0,0 +1,615 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#include "MetalScrollPCH.h"
+#include "Benchmark.h"
+#include "Utils.h"
+#include "RenderCore.h"
+#include "BarRenderOp.h"
+#include "CodePreview.h"
+#include "CpuDispatch.h"
+#include "LineIndex.h"
+#include "TextSearch.h"
+#include "WordMatcher.h"
+
+#define BENCHMARK_NUM_LINES			50000
+#define BENCHMARK_REPEAT			5
+#define BENCHMARK_BAR_WIDTH			64
+#define BENCHMARK_BAR_HEIGHT		1000
+// A full height page marker on a tall monitor.
+#define BENCHMARK_CURSOR_HEIGHT		2000
+#define BENCHMARK_CURSOR_COLOR		0xe0000028
+// About 5 MB of text.
+#define BENCHMARK_SEARCH_LINES		80000
+
+#ifdef METALSCROLL_COUNT_ALLOCATIONS
+
+// Counts the allocations made through operator new in the whole add-in, which covers every std::vector and string.
+// The benchmarks use it to check that the warm paths don't allocate. Pixel arenas allocate with realloc() and keep
+// their own count. This replaces the allocator of the whole DLL, so it's only compiled into builds which define
+// METALSCROLL_COUNT_ALLOCATIONS; none of the project configurations do.
+static volatile LONG				g_numHeapAllocations = 0;
+
+void* operator new(size_t size)
+{
+	InterlockedIncrement(&g_numHeapAllocations);
+	void* ptr = malloc(size ? size : 1);
+	if(!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* ptr)
+{
+	free(ptr);
+}
+
+void operator delete[](void* ptr)
+{
+	free(ptr);
+}
+
+#endif
+
+class BenchmarkTimer
+{
+public:
+	BenchmarkTimer()
+	{
+		QueryPerformanceFrequency(&m_freq);
+		QueryPerformanceCounter(&m_start);
+	}
+
+	double GetMilliseconds() const
+	{
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		return 1000.0 * (now.QuadPart - m_start.QuadPart) / m_freq.QuadPart;
+	}
+
+private:
+	LARGE_INTEGER		m_freq;
+	LARGE_INTEGER		m_start;
+};
+
+// Keeps the fastest of several runs.
+class BestTime
+{
+public:
+	BestTime() : m_best(-1.0) {}
+
+	void Add(double ms)
+	{
+		if( (m_best < 0.0) || (ms < m_best) )
+			m_best = ms;
+	}
+
+	double Get() const { return m_best; }
+
+private:
+	double				m_best;
+};
+
+// Forwards to a concrete operator through the virtual interface, which is how every operator used to be called.
+template<class Op> struct VirtualRenderOp : public RenderOperator
+{
+	VirtualRenderOp(Op& _op) : op(_op) {}
+
+	void Init(int numLines) { op.Init(numLines); }
+	void EndLine(int line, int lastColumn, unsigned int lineFlags, bool textEnd) { op.EndLine(line, lastColumn, lineFlags, textEnd); }
+	void RenderSpaces(int line, int column, int count) { op.RenderSpaces(line, column, count); }
+	void RenderRun(int line, int column, const wchar_t* chars, int count, unsigned int flags) { op.RenderRun(line, column, chars, count, flags); }
+
+	Op& op;
+};
+
+// Something which looks like code as far as the lexer is concerned: indentation, keywords, identifiers, strings,
+// and both kinds of comments.
+static void GenerateBenchmarkText(std::wstring& text, int numLines)
+{
+	static const wchar_t* s_lines[] =
+	{
+		L"\tfor(int i = 0; i < count; ++i)",
+		L"\t\tresult += ComputeSomething(values[i], \"string with \\\" quote\");",
+		L"\t// A single line comment explaining things.",
+		L"\t/* A multi-line comment",
+		L"\t   which ends here. */",
+		L"\tif(m_someMember && !IsEnabled()) return false; // trailing comment",
+		L"class SomeClass : public BaseClass",
+		L"{",
+		L"};",
+		L""
+	};
+	const int numPatterns = sizeof(s_lines) / sizeof(s_lines[0]);
+
+	text.clear();
+	unsigned int seed = 1;
+	for(int i = 0; i < numLines; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		if(i > 0)
+			text += L"\r\n";
+		text += s_lines[(seed >> 16) % numPatterns];
+	}
+}
+
+template<class Op> static double TimeRender(Op& op, const RenderContext& ctx, const LineList& lines)
+{
+	BestTime best;
+	for(int i = 0; i < BENCHMARK_REPEAT; ++i)
+	{
+		BenchmarkTimer timer;
+		op.Init((int)lines.size());
+		unsigned int lexerState = LexerState_Code;
+		int virtualLine = 0;
+		int realLine = 0;
+		for(const wchar_t* lineStart = ctx.text; lineStart; ++realLine)
+			lineStart = RenderLine(op, ctx, lineStart, lines[realLine], lexerState, virtualLine);
+
+		best.Add(timer.GetMilliseconds());
+	}
+
+	return best.Get();
+}
+
+static void BenchmarkRenderPaths()
+{
+	std::wstring text;
+	GenerateBenchmarkText(text, BENCHMARK_NUM_LINES);
+
+	LineInfo defaultLineInfo = { 0 };
+	LineList lines(BENCHMARK_NUM_LINES, defaultLineInfo);
+
+	struct Language
+	{
+		const char*			name;
+		bool				isCppLike;
+		IsKeywordFnPtr		keywordFn;
+	} languages[] =
+	{
+		{ "C++", true, IsCppKeyword },
+		{ "UnrealScript", true, IsUscriptKeyword },
+		{ "plain text", false, 0 }
+	};
+
+	for(int i = 0; i < sizeof(languages) / sizeof(languages[0]); ++i)
+	{
+		RenderContext ctx;
+		ctx.text = text.c_str();
+		ctx.tabSize = 4;
+		ctx.wrapAfter = INT_MAX;
+		ctx.isCppLikeLanguage = languages[i].isCppLike;
+		ctx.keywordFn = languages[i].keywordFn;
+
+		PixelArena img;
+		BarRenderOp barOp(img, BENCHMARK_BAR_WIDTH);
+		VirtualRenderOp<BarRenderOp> virtualBarOp(barOp);
+		double barVirtual = TimeRender<RenderOperator>(virtualBarOp, ctx, lines);
+		double barSpecialized = TimeRender(barOp, ctx, lines);
+
+		std::vector<CodePreview::CharInfo> chars;
+		PreviewRenderOp previewOp(chars, 80);
+		VirtualRenderOp<PreviewRenderOp> virtualPreviewOp(previewOp);
+		double previewVirtual = TimeRender<RenderOperator>(virtualPreviewOp, ctx, lines);
+		double previewSpecialized = TimeRender(previewOp, ctx, lines);
+
+		Log("MetalScroll: %d lines of %s: bar %.2f ms virtual, %.2f ms specialized; preview %.2f ms virtual, %.2f ms specialized.\n",
+			BENCHMARK_NUM_LINES, languages[i].name, barVirtual, barSpecialized, previewVirtual, previewSpecialized);
+	}
+}
+
+// Finds every match line by line, the way word highlighting does. Can also add up the offsets of the matches, so that
+// the search kernels can be checked against each other.
+static int CountMatches(const wchar_t* (*findText)(const SearchPattern&, const wchar_t*, const wchar_t*, const wchar_t*),
+	const SearchPattern& pattern, const LineIndex& lineIndex, unsigned int* offsetSum = 0)
+{
+	int numMatches = 0;
+	unsigned int sum = 0;
+	const wchar_t* text = lineIndex.GetLineStart(0);
+	for(int line = 0; line < lineIndex.GetNumLines(); ++line)
+	{
+		const wchar_t* lineStart = lineIndex.GetLineStart(line);
+		const wchar_t* lineEnd = lineStart + lineIndex.GetLineLength(line);
+		for(const wchar_t* chr = lineStart; (chr = findText(pattern, text, chr, lineEnd)) != 0; chr += pattern.length)
+		{
+			++numMatches;
+			sum += (unsigned int)(chr - text);
+		}
+	}
+
+	if(offsetSum)
+		*offsetSum = sum;
+	return numMatches;
+}
+
+// Logs a mismatch between a kernel and the plain C version, which is the reference for all the others.
+static bool CheckKernelOutput(bool matches, int level, const char* kernelName)
+{
+	if(!matches)
+		Log("MetalScroll: FAILED: the %s %s doesn't match the plain C one.\n", GetCpuLevelName((CpuLevel)level), kernelName);
+	return matches;
+}
+
+static bool SameLineStarts(const LineIndex& a, const LineIndex& b)
+{
+	if( (a.GetNumLines() != b.GetNumLines()) || (a.GetTextLength() != b.GetTextLength()) )
+		return false;
+	for(int i = 0; i < a.GetNumLines(); ++i)
+	{
+		if(a.GetLineOffset(i) != b.GetLineOffset(i))
+			return false;
+	}
+	return true;
+}
+
+// The float scaling kernels round differently from the plain C one, and the fixed point kernel has less precision,
+// so the colors can be off by one. The plain C kernel doesn't write the alpha channel.
+static bool SameScaledPixels(const std::vector<unsigned int>& a, const std::vector<unsigned int>& b)
+{
+	for(size_t i = 0; i < a.size(); ++i)
+	{
+		for(int k = 0; k < 24; k += 8)
+		{
+			int diff = (int)((a[i] >> k) & 0xff) - (int)((b[i] >> k) & 0xff);
+			if( (diff < -1) || (diff > 1) )
+				return false;
+		}
+	}
+	return true;
+}
+
+static bool BenchmarkKernels()
+{
+	std::wstring text;
+	GenerateBenchmarkText(text, BENCHMARK_NUM_LINES);
+
+	RenderContext ctx;
+	ctx.text = text.c_str();
+	ctx.tabSize = 4;
+	ctx.wrapAfter = INT_MAX;
+	ctx.isCppLikeLanguage = true;
+	ctx.keywordFn = IsCppKeyword;
+
+	LineInfo defaultLineInfo = { 0 };
+	LineList lines(BENCHMARK_NUM_LINES, defaultLineInfo);
+
+	PixelArena img;
+	BarRenderOp barOp(img, BENCHMARK_BAR_WIDTH);
+	TimeRender(barOp, ctx, lines);
+
+	unsigned int palette[ColorClass_Count] = { 0xfff5f5f5, 0xff101010, 0xff808080, 0xff008000, 0xffff8000 };
+	std::vector<unsigned int> expanded(BENCHMARK_NUM_LINES * BENCHMARK_BAR_WIDTH);
+	std::vector<unsigned int> scaled(BENCHMARK_BAR_HEIGHT * BENCHMARK_BAR_WIDTH);
+	std::vector<unsigned int> cursorBand(BENCHMARK_CURSOR_HEIGHT * BENCHMARK_BAR_WIDTH);
+
+	// The outputs of the plain C kernels, which the other levels are checked against. Timings are only worth
+	// something if the kernels are right, and the AVX2 ones aren't built by every compiler the project supports.
+	LineIndex refLineIndex;
+	std::vector<unsigned int> refExpanded, refScaled, refCursorBand;
+	unsigned __int64 refHash = 0;
+	bool ok = true;
+
+	// Run every level the CPU supports, then go back to the one we started with.
+	CpuLevel savedLevel = g_cpuLevel;
+	for(int level = CpuLevel_PlainC; level <= GetDetectedCpuLevel(); ++level)
+	{
+		SetCpuLevel((CpuLevel)level);
+
+		BestTime lineIndexTime, expandTime, scaleTime, hashTime, blendTime;
+		LineIndex lineIndex;
+		unsigned __int64 hash = 0;
+		for(int i = 0; i < BENCHMARK_REPEAT; ++i)
+		{
+			BenchmarkTimer lineIndexTimer;
+			lineIndex.Build(text.c_str());
+			lineIndexTime.Add(lineIndexTimer.GetMilliseconds());
+
+			BenchmarkTimer expandTimer;
+			g_kernels.expandPalette(&expanded[0], img.GetData(), (int)expanded.size(), palette, ColorClass_Count);
+			expandTime.Add(expandTimer.GetMilliseconds());
+
+			BenchmarkTimer scaleTimer;
+			FlipScalePaletteImage(&scaled[0], BENCHMARK_BAR_HEIGHT, img.GetData(), BENCHMARK_NUM_LINES, BENCHMARK_BAR_WIDTH, palette, ColorClass_Count);
+			scaleTime.Add(scaleTimer.GetMilliseconds());
+
+			BenchmarkTimer hashTimer;
+			hash = g_kernels.hashBytes(text.c_str(), (unsigned int)(text.size() * sizeof(wchar_t)), 0);
+			hashTime.Add(hashTimer.GetMilliseconds());
+
+			// Blending the same pixels over and over would saturate them, so start from the image every time.
+			for(size_t j = 0; j < cursorBand.size(); ++j)
+				cursorBand[j] = expanded[j];
+			BenchmarkTimer blendTimer;
+			g_kernels.blendCursor(&cursorBand[0], (int)cursorBand.size(), BENCHMARK_CURSOR_COLOR);
+			blendTime.Add(blendTimer.GetMilliseconds());
+		}
+
+		Log("MetalScroll: %s kernels: line index %.2f ms, palette expansion %.2f ms, scaling to %d lines %.2f ms, text hash %.2f ms, cursor blend %.3f ms.\n",
+			GetCpuLevelName((CpuLevel)level), lineIndexTime.Get(), expandTime.Get(), BENCHMARK_BAR_HEIGHT, scaleTime.Get(), hashTime.Get(), blendTime.Get());
+
+		if(level == CpuLevel_PlainC)
+		{
+			refLineIndex.Build(text.c_str());
+			refExpanded = expanded;
+			refScaled = scaled;
+			refHash = hash;
+			refCursorBand = cursorBand;
+			continue;
+		}
+
+		ok &= CheckKernelOutput(SameLineStarts(lineIndex, refLineIndex), level, "line scanner");
+		ok &= CheckKernelOutput(expanded == refExpanded, level, "palette expansion");
+		ok &= CheckKernelOutput(SameScaledPixels(scaled, refScaled), level, "scaler");
+		ok &= CheckKernelOutput(hash == refHash, level, "text hash");
+		ok &= CheckKernelOutput(cursorBand == refCursorBand, level, "cursor blend");
+
+		// A common word, so that the vector search kernels have lots of candidates to verify.
+		for(int mode = 0; mode < 4; ++mode)
+		{
+			bool ignoreCase = (mode & 2) != 0;
+			SearchPattern pattern(L"e", 1, (mode & 1) != 0);
+			unsigned int offsetSum, refOffsetSum;
+			int numMatches = CountMatches(ignoreCase ? g_kernels.findTextNoCase : g_kernels.findText, pattern, lineIndex, &offsetSum);
+			int numRefMatches = CountMatches(ignoreCase ? FindTextNoCasePlainC : FindTextPlainC, pattern, lineIndex, &refOffsetSum);
+			ok &= CheckKernelOutput((numMatches == numRefMatches) && (offsetSum == refOffsetSum), level,
+				ignoreCase ? "case insensitive search" : "search");
+		}
+	}
+
+	SetCpuLevel(savedLevel);
+	return ok;
+}
+
+static bool BenchmarkCacheUpdates()
+{
+	std::wstring text;
+	GenerateBenchmarkText(text, BENCHMARK_NUM_LINES);
+
+	// Change one letter in the middle of the text. Alternating between the two versions re-renders a few lines
+	// on every update, which is what typing looks like to the cache.
+	std::wstring editedText = text;
+	size_t editPos = text.size() / 2;
+	while(!iswalpha(text[editPos]))
+		++editPos;
+	editedText[editPos] = (text[editPos] == L'x') ? L'y' : L'x';
+
+	RenderContext ctx;
+	ctx.text = text.c_str();
+	ctx.tabSize = 4;
+	ctx.wrapAfter = INT_MAX;
+	ctx.isCppLikeLanguage = true;
+	ctx.keywordFn = IsCppKeyword;
+
+	// The first update renders everything, the second one warms up the scratch space for partial updates.
+	RenderCache cache;
+	LineList lines;
+	int firstDirtyLine, endDirtyLine;
+	cache.Update(ctx, lines, BENCHMARK_BAR_WIDTH, &firstDirtyLine, &endDirtyLine);
+	ctx.text = editedText.c_str();
+	cache.Update(ctx, lines, BENCHMARK_BAR_WIDTH, &firstDirtyLine, &endDirtyLine);
+
+	LONG startArenaAllocations = PixelArena::GetNumAllocations();
+#ifdef METALSCROLL_COUNT_ALLOCATIONS
+	LONG startHeapAllocations = g_numHeapAllocations;
+#endif
+	BestTime updateTime;
+	for(int i = 0; i < BENCHMARK_REPEAT; ++i)
+	{
+		ctx.text = (i & 1) ? editedText.c_str() : text.c_str();
+		BenchmarkTimer timer;
+		cache.Update(ctx, lines, BENCHMARK_BAR_WIDTH, &firstDirtyLine, &endDirtyLine);
+		updateTime.Add(timer.GetMilliseconds());
+	}
+
+	// The timer and Log() don't allocate, so everything counted comes from the updates.
+	int numArenaAllocations = int(PixelArena::GetNumAllocations() - startArenaAllocations);
+#ifdef METALSCROLL_COUNT_ALLOCATIONS
+	int numHeapAllocations = int(g_numHeapAllocations - startHeapAllocations);
+	Log("MetalScroll: one line edit in %d lines: cache update %.2f ms, %d heap and %d pixel arena allocations in %d warm updates.\n",
+		BENCHMARK_NUM_LINES, updateTime.Get(), numHeapAllocations, numArenaAllocations, BENCHMARK_REPEAT);
+#else
+	int numHeapAllocations = 0;
+	Log("MetalScroll: one line edit in %d lines: cache update %.2f ms, %d pixel arena allocations in %d warm updates (heap allocations aren't counted in this build).\n",
+		BENCHMARK_NUM_LINES, updateTime.Get(), numArenaAllocations, BENCHMARK_REPEAT);
+#endif
+
+	if(numHeapAllocations || numArenaAllocations)
+	{
+		Log("MetalScroll: FAILED: warm cache updates allocated memory.\n");
+		return false;
+	}
+	return true;
+}
+
+static void BenchmarkResize()
+{
+	std::wstring text;
+	GenerateBenchmarkText(text, BENCHMARK_NUM_LINES);
+
+	RenderContext ctx;
+	ctx.text = text.c_str();
+	ctx.tabSize = 4;
+	ctx.wrapAfter = INT_MAX;
+	ctx.isCppLikeLanguage = true;
+	ctx.keywordFn = IsCppKeyword;
+
+	unsigned int palette[ColorClass_Count] = { 0xfff5f5f5, 0xff101010, 0xff808080, 0xff008000, 0xffff8000 };
+	std::vector<unsigned int> scaled(BENCHMARK_BAR_HEIGHT * BENCHMARK_BAR_WIDTH);
+
+	// Dragging the window border goes through a range of heights. Before, each of them rendered the text again;
+	// now only the scaling step runs.
+	BestTime renderTime, rescaleTime;
+	LineList lines;
+	int firstDirtyLine, endDirtyLine;
+	for(int i = 0; i < BENCHMARK_REPEAT; ++i)
+	{
+		int barHeight = BENCHMARK_BAR_HEIGHT - i * BENCHMARK_BAR_HEIGHT / (2 * BENCHMARK_REPEAT);
+
+		BenchmarkTimer renderTimer;
+		RenderCache cache;
+		cache.Update(ctx, lines, BENCHMARK_BAR_WIDTH, &firstDirtyLine, &endDirtyLine);
+		FlipScalePaletteImage(&scaled[0], barHeight, cache.GetImage(), cache.GetNumVirtualLines(), BENCHMARK_BAR_WIDTH, palette, ColorClass_Count);
+		renderTime.Add(renderTimer.GetMilliseconds());
+
+		BenchmarkTimer rescaleTimer;
+		FlipScalePaletteImage(&scaled[0], barHeight, cache.GetImage(), cache.GetNumVirtualLines(), BENCHMARK_BAR_WIDTH, palette, ColorClass_Count);
+		rescaleTime.Add(rescaleTimer.GetMilliseconds());
+	}
+
+	Log("MetalScroll: resizing the bar for %d lines: %.2f ms re-rendering, %.2f ms re-scaling only.\n",
+		BENCHMARK_NUM_LINES, renderTime.Get(), rescaleTime.Get());
+}
+
+static void BenchmarkSearch()
+{
+	std::wstring text;
+	GenerateBenchmarkText(text, BENCHMARK_SEARCH_LINES);
+	LineIndex lineIndex;
+	lineIndex.Build(text.c_str());
+
+	// A short word, a long one, and a very common one which gives the vector kernels lots of candidates to verify.
+	static const wchar_t* s_words[] = { L"if", L"ComputeSomething(values[i]", L"e" };
+	static const char* s_wordNames[] = { "a short word", "a long word", "a common word" };
+
+	for(int i = 0; i < (int)(sizeof(s_words) / sizeof(s_words[0])); ++i)
+	{
+		for(int mode = 0; mode < 4; ++mode)
+		{
+			bool wholeWord = (mode & 1) != 0;
+			bool ignoreCase = (mode & 2) != 0;
+			const wchar_t* (*plainFindText)(const SearchPattern&, const wchar_t*, const wchar_t*, const wchar_t*) =
+				ignoreCase ? FindTextNoCasePlainC : FindTextPlainC;
+			const wchar_t* (*kernelFindText)(const SearchPattern&, const wchar_t*, const wchar_t*, const wchar_t*) =
+				ignoreCase ? g_kernels.findTextNoCase : g_kernels.findText;
+
+			SearchPattern pattern(s_words[i], (unsigned int)wcslen(s_words[i]), wholeWord);
+			BestTime plainTime, kernelTime;
+			int numMatches = 0;
+			for(int j = 0; j < BENCHMARK_REPEAT; ++j)
+			{
+				BenchmarkTimer plainTimer;
+				numMatches = CountMatches(plainFindText, pattern, lineIndex);
+				plainTime.Add(plainTimer.GetMilliseconds());
+
+				BenchmarkTimer kernelTimer;
+				CountMatches(kernelFindText, pattern, lineIndex);
+				kernelTime.Add(kernelTimer.GetMilliseconds());
+			}
+
+			Log("MetalScroll: searching %.1f MB for %s%s%s: %d matches, %.2f ms plain C, %.2f ms %s.\n",
+				text.size() * sizeof(wchar_t) / (1024.0 * 1024.0), s_wordNames[i], wholeWord ? " (whole word)" : "",
+				ignoreCase ? " (ignoring case)" : "", numMatches, plainTime.Get(), kernelTime.Get(), GetCpuLevelName(g_cpuLevel));
+		}
+	}
+}
+
+static void BenchmarkIdentifierIndex()
+{
+	std::wstring text;
+	GenerateBenchmarkText(text, BENCHMARK_SEARCH_LINES);
+	LineIndex lineIndex;
+	lineIndex.Build(text.c_str());
+
+	RenderContext ctx;
+	ctx.text = text.c_str();
+	ctx.tabSize = 4;
+	ctx.wrapAfter = INT_MAX;
+	ctx.isCppLikeLanguage = true;
+	ctx.keywordFn = IsCppKeyword;
+
+	RenderCache cache;
+	LineList lines;
+	int firstDirtyLine, endDirtyLine;
+	cache.Update(ctx, lines, BENCHMARK_BAR_WIDTH, &firstDirtyLine, &endDirtyLine);
+	IdentifierIndex& index = cache.GetIdentifierIndex();
+	index.SetTextHash(1);
+
+	// Whole word highlighting of an identifier, searching the text versus looking it up in the index.
+	SearchPattern pattern(L"values", 6, true);
+	std::vector<IdentifierIndex::Span> spans;
+	BestTime searchTime, lookupTime;
+	int numMatches = 0;
+	for(int i = 0; i < BENCHMARK_REPEAT; ++i)
+	{
+		BenchmarkTimer searchTimer;
+		numMatches = CountMatches(g_kernels.findText, pattern, lineIndex);
+		searchTime.Add(searchTimer.GetMilliseconds());
+
+		BenchmarkTimer lookupTimer;
+		index.Find(1, pattern.word, pattern.length, true, spans);
+		lookupTime.Add(lookupTimer.GetMilliseconds());
+	}
+
+	Log("MetalScroll: highlighting an identifier in %d lines: %d matches, %.2f ms searching, %.3f ms from the identifier index (%d matches).\n",
+		BENCHMARK_SEARCH_LINES, numMatches, searchTime.Get(), lookupTime.Get(), (int)spans.size());
+}
+
+static void BenchmarkPinnedWords()
+{
+	std::wstring text;
+	GenerateBenchmarkText(text, BENCHMARK_SEARCH_LINES);
+	LineIndex lineIndex;
+	lineIndex.Build(text.c_str());
+
+	// All the pinned words in one pass over the text, versus searching for each of them in turn.
+	static const wchar_t* s_words[MAX_PINNED_WORDS] = { L"values", L"count", L"SomeClass" };
+	WordMatcher* matcher = new WordMatcher(true, true);
+	for(int i = 0; i < MAX_PINNED_WORDS; ++i)
+		matcher->AddWord(s_words[i], (unsigned int)wcslen(s_words[i]), i);
+	matcher->Build();
+
+	std::vector<WordMatcher::Match> matches;
+	BestTime searchTime, matcherTime;
+	int numMatches = 0;
+	for(int i = 0; i < BENCHMARK_REPEAT; ++i)
+	{
+		BenchmarkTimer searchTimer;
+		numMatches = 0;
+		for(int w = 0; w < MAX_PINNED_WORDS; ++w)
+		{
+			SearchPattern pattern(s_words[w], (unsigned int)wcslen(s_words[w]), true);
+			numMatches += CountMatches(g_kernels.findText, pattern, lineIndex);
+		}
+		searchTime.Add(searchTimer.GetMilliseconds());
+
+		BenchmarkTimer matcherTimer;
+		matches.clear();
+		matcher->FindMatches(text.c_str(), matches);
+		matcherTime.Add(matcherTimer.GetMilliseconds());
+	}
+	matcher->Release();
+
+	Log("MetalScroll: matching %d pinned words in %d lines: %d matches, %.2f ms searching for each, %.2f ms in one pass (%d matches).\n",
+		MAX_PINNED_WORDS, BENCHMARK_SEARCH_LINES, numMatches, searchTime.Get(), matcherTime.Get(), (int)matches.size());
+}
+
+bool RunBenchmarks()
+{
+	bool ok = true;
+	BenchmarkRenderPaths();
+	ok &= BenchmarkKernels();
+	ok &= BenchmarkCacheUpdates();
+	BenchmarkResize();
+	BenchmarkSearch();
+	BenchmarkIdentifierIndex();
+	BenchmarkPinnedWords();
+	return ok;
+}
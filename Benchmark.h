@@ -0,0 +1,22 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#pragma once
+
+// Times the render paths on generated text and writes the results to the debug output. Runs at startup when
+// the RunBenchmarks registry value is set. Returns false if a benchmark found something wrong besides the timings,
+// such as warm paths which allocate; the details are in the debug output too.
+bool RunBenchmarks();
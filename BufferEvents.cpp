@@ -0,0 +1,86 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#include "MetalScrollPCH.h"
+#include "BufferEvents.h"
+#include "MetalBar.h"
+
+CBufferEvents::CBufferEvents()
+{
+	m_bar = 0;
+	m_connPt = 0;
+	m_cookie = 0;
+}
+
+CBufferEvents* CBufferEvents::Attach(MetalBar* bar)
+{
+	CComPtr<IVsTextLines> buffer;
+	HRESULT hr = bar->GetView()->GetBuffer(&buffer);
+	if(FAILED(hr) || !buffer)
+		return 0;
+
+	CComQIPtr<IConnectionPointContainer> connPoints = buffer;
+	if(!connPoints)
+		return 0;
+
+	CComPtr<IConnectionPoint> connPt;
+	hr = connPoints->FindConnectionPoint(__uuidof(IVsTextLinesEvents), &connPt);
+	if(FAILED(hr) || !connPt)
+		return 0;
+
+	// This class isn't a registered coclass, so create it directly instead of going through CoCreateInstance().
+	CComObject<CBufferEvents>* events;
+	hr = CComObject<CBufferEvents>::CreateInstance(&events);
+	if(FAILED(hr) || !events)
+		return 0;
+	events->AddRef();
+
+	hr = connPt->Advise((IVsTextLinesEvents*)events, &events->m_cookie);
+	if(FAILED(hr))
+	{
+		events->Release();
+		return 0;
+	}
+
+	events->m_bar = bar;
+	events->m_connPt = connPt.Detach();
+	return events;
+}
+
+void CBufferEvents::Detach()
+{
+	m_bar = 0;
+
+	if(m_connPt)
+	{
+		m_connPt->Unadvise(m_cookie);
+		m_connPt->Release();
+		m_connPt = 0;
+	}
+}
+
+void STDMETHODCALLTYPE CBufferEvents::OnChangeLineText(const TextLineChange* change, BOOL /*last*/)
+{
+	if(m_bar)
+		m_bar->OnTextChanged(*change);
+}
+
+void STDMETHODCALLTYPE CBufferEvents::OnChangeLineAttributes(long /*firstLine*/, long /*lastLine*/)
+{
+	// Marker changes (breakpoints, bookmarks, highlighted words, modified line flags) come through here.
+	if(m_bar)
+		m_bar->OnBufferChanged(false);
+}
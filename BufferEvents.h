@@ -0,0 +1,56 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#pragma once
+
+class MetalBar;
+
+// Listens to the change notifications of the text buffer behind a bar, so the code image is only refreshed
+// when the text or the line markers actually change.
+class ATL_NO_VTABLE CBufferEvents :
+	public CComObjectRootEx<CComSingleThreadModel>,
+	public IVsTextLinesEvents
+{
+public:
+	CBufferEvents();
+
+	BEGIN_COM_MAP(CBufferEvents)
+		COM_INTERFACE_ENTRY(IVsTextLinesEvents)
+	END_COM_MAP()
+
+	DECLARE_PROTECT_FINAL_CONSTRUCT()
+
+	HRESULT FinalConstruct()
+	{
+		return S_OK;
+	}
+
+	void FinalRelease()
+	{
+	}
+
+	static CBufferEvents*		Attach(MetalBar* bar);
+	void						Detach();
+
+	// IVsTextLinesEvents implementation.
+	void STDMETHODCALLTYPE		OnChangeLineText(const TextLineChange* change, BOOL last);
+	void STDMETHODCALLTYPE		OnChangeLineAttributes(long firstLine, long lastLine);
+
+private:
+	MetalBar*					m_bar;
+	IConnectionPoint*			m_connPt;
+	DWORD						m_cookie;
+};
@@ -18,7 +18,7 @@
 #include "CodePreview.h"
 #include "Utils.h"
 #include "MetalBar.h"
-#include "TextFormatting.h"
+#include "RenderCore.h"
 
 #define HORIZ_MARGIN		5
 #define VERT_MARGIN			5
@@ -130,58 +130,7 @@ void CodePreview::Create(HWND parent, int width, int height)
 	m_hwnd = CreateWindowA(s_className, "CodePreview", style, 0, 0, m_wndWidth, m_wndHeight, parent, 0, _AtlModule.GetResourceInstance(), this);
 }
 
-struct PreviewRenderOp : RenderOperator
-{
-	PreviewRenderOp(std::vector<CodePreview::CharInfo>& text, int lineWidth) : m_text(text), m_lineWidth(lineWidth) {}
-
-	void Init(int numLines)
-	{
-		m_text.reserve(numLines*m_lineWidth);
-		m_text.resize(m_lineWidth);
-	}
-
-	void EndLine(int line, int lastColumn, unsigned int /*lineFlags*/, bool textEnd)
-	{
-		if(lastColumn < m_lineWidth)
-			m_text[line*m_lineWidth + lastColumn].format = CodePreview::FormatType_EOL;
-
-		if(!textEnd)
-			m_text.resize((line + 2) * m_lineWidth);
-	}
-
-	void RenderSpaces(int line, int column, int count)
-	{
-		for(int i = column; (i < column + count) && (i < m_lineWidth); ++i)
-		{
-			m_text[line*m_lineWidth + i].format = CodePreview::FormatType_Plain;
-			m_text[line*m_lineWidth + i].chr = L' ';
-		}
-	}
-
-	void RenderCharacter(int line, int column, wchar_t chr, unsigned int flags)
-	{
-		if(column >= m_lineWidth)
-			return;
-
-		unsigned char format;
-		if(flags & TextFlag_Highlight)
-			format = CodePreview::FormatType_Highlight;
-		else if(flags & TextFlag_Comment)
-			format = CodePreview::FormatType_Comment;
-		else if(flags & TextFlag_Keyword)
-			format = CodePreview::FormatType_Keyword;
-		else
-			format = CodePreview::FormatType_Plain;
-
-		m_text[line*m_lineWidth + column].format = format;
-		m_text[line*m_lineWidth + column].chr = chr;
-	}
-
-	std::vector<CodePreview::CharInfo>& m_text;
-	int m_lineWidth;
-};
-
-void CodePreview::Show(HWND bar, IVsTextView* view, IVsTextLines* buffer, const wchar_t* text, int numLines)
+void CodePreview::Show(HWND bar, IVsTextView* view, IVsTextLines* buffer, const wchar_t* text, int numLines, const MatchStore* matches)
 {
 	RECT r;
 	GetClientRect(bar, &r);
@@ -209,7 +158,7 @@ void CodePreview::Show(HWND bar, IVsTextView* view, IVsTextLines* buffer, const
 
 	int charsPerLine = (m_wndWidth - HORIZ_MARGIN*2) / s_charWidth;
 	PreviewRenderOp renderOp(m_text, charsPerLine);
-	m_imgNumLines = RenderText(renderOp, view, buffer, text, numLines);
+	m_imgNumLines = RenderText(renderOp, view, buffer, text, numLines, matches);
 
 	ShowWindow(m_hwnd, SW_SHOW);
 }
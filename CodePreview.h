@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include "TextFormatting.h"
+
 class CodePreview
 {
 public:
@@ -27,18 +29,11 @@ public:
 	void						Create(HWND parent, int width, int height);
 	void						Destroy();
 
-	void						Show(HWND bar, IVsTextView* view, IVsTextLines* buffer, const wchar_t* text, int numLines);
+	void						Show(HWND bar, IVsTextView* view, IVsTextLines* buffer, const wchar_t* text, int numLines, const MatchStore* matches);
 	void						Hide();
 	void						Update(int y, int line);
 	void						Resize(int width, int height);
 
-private:
-	static const char			s_className[];
-	static HFONT				s_normalFont;
-	static HFONT				s_boldFont;
-	static int					s_charWidth;
-	static int					s_lineHeight;
-
 	enum FormatType
 	{
 		FormatType_Plain,
@@ -54,6 +49,13 @@ private:
 		unsigned char	format;
 	};
 
+private:
+	static const char			s_className[];
+	static HFONT				s_normalFont;
+	static HFONT				s_boldFont;
+	static int					s_charWidth;
+	static int					s_lineHeight;
+
 	HWND						m_hwnd;
 	HDC							m_paintDC;
 	HBITMAP						m_codeBmp;
@@ -69,5 +71,63 @@ private:
 	void						OnPaint(HDC dc);
 	void						FlushTextBuf(std::vector<wchar_t>& buf, unsigned char format, int x, int y);
 
-	friend struct PreviewRenderOp;
+};
+
+// Fills the character grid of the code preview.
+struct PreviewRenderOp
+{
+	PreviewRenderOp(std::vector<CodePreview::CharInfo>& text, int lineWidth) : m_text(text), m_lineWidth(lineWidth) {}
+
+	void Init(int numLines)
+	{
+		m_text.reserve(numLines*m_lineWidth);
+		m_text.resize(m_lineWidth);
+	}
+
+	void EndLine(int line, int lastColumn, unsigned int /*lineFlags*/, bool textEnd)
+	{
+		if(lastColumn < m_lineWidth)
+			m_text[line*m_lineWidth + lastColumn].format = CodePreview::FormatType_EOL;
+
+		if(!textEnd)
+			m_text.resize((line + 2) * m_lineWidth);
+	}
+
+	void RenderSpaces(int line, int column, int count)
+	{
+		CodePreview::CharInfo space;
+		space.format = CodePreview::FormatType_Plain;
+		space.chr = L' ';
+
+		int end = std::min(column + count, m_lineWidth);
+		if(column < end)
+			std::fill(m_text.begin() + line*m_lineWidth + column, m_text.begin() + line*m_lineWidth + end, space);
+	}
+
+	void RenderRun(int line, int column, const wchar_t* chars, int count, unsigned int flags)
+	{
+		if(column >= m_lineWidth)
+			return;
+
+		unsigned char format;
+		if(flags & TextFlag_Highlight)
+			format = CodePreview::FormatType_Highlight;
+		else if(flags & TextFlag_Comment)
+			format = CodePreview::FormatType_Comment;
+		else if(flags & TextFlag_Keyword)
+			format = CodePreview::FormatType_Keyword;
+		else
+			format = CodePreview::FormatType_Plain;
+
+		count = std::min(count, m_lineWidth - column);
+		CodePreview::CharInfo* dest = &m_text[line*m_lineWidth + column];
+		for(int i = 0; i < count; ++i)
+		{
+			dest[i].format = format;
+			dest[i].chr = chars[i];
+		}
+	}
+
+	std::vector<CodePreview::CharInfo>& m_text;
+	int m_lineWidth;
 };
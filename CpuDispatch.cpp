@@ -0,0 +1,115 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#include "MetalScrollPCH.h"
+#include "CpuDispatch.h"
+#include "Fingerprint.h"
+#include "LineIndex.h"
+#include "TextSearch.h"
+#include "Utils.h"
+
+CpuKernels g_kernels;
+CpuLevel g_cpuLevel = CpuLevel_PlainC;
+
+static CpuLevel g_detectedCpuLevel = CpuLevel_PlainC;
+
+static CpuLevel DetectCpuLevel()
+{
+	int info[4];
+	__cpuid(info, 1);
+	if(!(info[3] & (1 << 26)))
+		return CpuLevel_PlainC;
+	if(!(info[2] & (1 << 19)))
+		return CpuLevel_SSE2;
+
+#if _MSC_VER >= 1700
+	// AVX2 also needs the OS to save the YMM registers on context switches.
+	bool hasOSXSAVE = (info[2] & (1 << 27)) != 0;
+	bool hasAVX = (info[2] & (1 << 28)) != 0;
+	if(!hasOSXSAVE || !hasAVX)
+		return CpuLevel_SSE41;
+
+	unsigned __int64 osState = _xgetbv(0);
+	if((osState & 6) != 6)
+		return CpuLevel_SSE41;
+
+	__cpuidex(info, 7, 0);
+	if(!(info[1] & (1 << 5)))
+		return CpuLevel_SSE41;
+
+	// There are no AVX-512 kernels, so AVX2 is as far as detection goes.
+	return CpuLevel_AVX2;
+#else
+	// The compiler can't generate AVX code, so there's no point in going further.
+	return CpuLevel_SSE41;
+#endif
+}
+
+static void BindKernels(CpuLevel level)
+{
+	g_cpuLevel = level;
+
+	bool sse2 = (level >= CpuLevel_SSE2);
+	g_kernels.findLineStarts = sse2 ? FindLineStartsSSE2 : FindLineStartsPlainC;
+	g_kernels.findText = sse2 ? FindTextSSE2 : FindTextPlainC;
+	g_kernels.findTextNoCase = sse2 ? FindTextNoCaseSSE2 : FindTextNoCasePlainC;
+	// Without PSHUFB, selecting between the palette entries costs more than a table lookup.
+	g_kernels.expandPalette = (level >= CpuLevel_SSE41) ? ExpandPaletteSSE41 : ExpandPalettePlainC;
+	g_kernels.blendCursor = sse2 ? BlendCursorSSE2 : BlendCursorPlainC;
+	g_kernels.hashBytes = (level >= CpuLevel_SSE41) ? HashBytesSSE41 : HashBytesPlainC;
+	g_kernels.scaleStartRow = sse2 ? ScaleStartRowSSE : ScaleStartRowPlainC;
+	g_kernels.scaleAddRow = sse2 ? ScaleAddRowSSE : ScaleAddRowPlainC;
+	g_kernels.scaleFinishRow = sse2 ? ScaleFinishRowSSE : ScaleFinishRowPlainC;
+	g_kernels.fixedScaleStartRow = 0;
+	g_kernels.fixedScaleAddRow = 0;
+	g_kernels.fixedScaleFinishRow = 0;
+#if _MSC_VER >= 1700
+	if(level >= CpuLevel_AVX2)
+	{
+		g_kernels.findLineStarts = FindLineStartsAVX2;
+		g_kernels.findText = FindTextAVX2;
+		g_kernels.findTextNoCase = FindTextNoCaseAVX2;
+		g_kernels.blendCursor = BlendCursorAVX2;
+		g_kernels.hashBytes = HashBytesAVX2;
+		g_kernels.fixedScaleStartRow = FixedScaleStartRowAVX2;
+		g_kernels.fixedScaleAddRow = FixedScaleAddRowAVX2;
+		g_kernels.fixedScaleFinishRow = FixedScaleFinishRowAVX2;
+	}
+#endif
+}
+
+void InitCpuDispatch()
+{
+	g_detectedCpuLevel = DetectCpuLevel();
+	BindKernels(g_detectedCpuLevel);
+	Log("MetalScroll: using %s kernels.\n", GetCpuLevelName(g_detectedCpuLevel));
+}
+
+CpuLevel GetDetectedCpuLevel()
+{
+	return g_detectedCpuLevel;
+}
+
+void SetCpuLevel(CpuLevel level)
+{
+	BindKernels(std::min(level, g_detectedCpuLevel));
+}
+
+const char* GetCpuLevelName(CpuLevel level)
+{
+	static const char* s_names[] = { "plain C", "SSE2", "SSE4.1", "AVX2" };
+	return ((level >= 0) && (level < CpuLevel_Count)) ? s_names[level] : "unknown";
+}
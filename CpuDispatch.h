@@ -0,0 +1,65 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#pragma once
+
+struct SearchPattern;
+
+// Instruction set levels, in increasing order. Each level implies the ones below it.
+enum CpuLevel
+{
+	CpuLevel_PlainC,
+	CpuLevel_SSE2,
+	CpuLevel_SSE41,
+	CpuLevel_AVX2,
+	CpuLevel_Count
+};
+
+// The hot kernels, bound to the best implementation available at the current level.
+struct CpuKernels
+{
+	// Text.
+	unsigned int		(*findLineStarts)(const wchar_t* text, std::vector<unsigned int>& lineStarts);
+	const wchar_t*		(*findText)(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end);
+	const wchar_t*		(*findTextNoCase)(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end);
+
+	// Pixels.
+	void				(*expandPalette)(unsigned int* dest, const unsigned char* src, int count, const unsigned int* palette, int numColors);
+	void				(*blendCursor)(unsigned int* pixels, int count, unsigned int cursorColor);
+
+	// Scaling rows, see PaletteScaler. The fixed point kernels are null at the levels which don't have them.
+	void				(*scaleStartRow)(float* accum, const unsigned char* src, int width, const float* palette, float area);
+	void				(*scaleAddRow)(float* accum, const unsigned char* src, int width, const float* palette);
+	void				(*scaleFinishRow)(unsigned int* dest, const float* accum, const unsigned char* src, int width, const float* palette, float area, float invArea);
+	void				(*fixedScaleStartRow)(unsigned int* accum, const unsigned char* src, int width, const unsigned int* palette);
+	void				(*fixedScaleAddRow)(unsigned int* accum, const unsigned char* src, int width, const unsigned int* palette);
+	void				(*fixedScaleFinishRow)(unsigned int* dest, const unsigned int* accum, const unsigned char* src, int width, const unsigned int* palette);
+
+	// Fingerprints.
+	unsigned __int64	(*hashBytes)(const void* data, unsigned int size, unsigned __int64 seed);
+};
+
+extern CpuKernels g_kernels;
+// Inline kernels check this directly instead of going through a function pointer.
+extern CpuLevel g_cpuLevel;
+
+// Detects the supported instruction sets and binds the kernels for the highest level.
+void InitCpuDispatch();
+CpuLevel GetDetectedCpuLevel();
+// Binds the kernels for a lower level than the detected one, so that all the paths can be compared on the same
+// machine. Levels above the detected one are clamped. Only call this while nothing is rendering.
+void SetCpuLevel(CpuLevel level);
+const char* GetCpuLevelName(CpuLevel level);
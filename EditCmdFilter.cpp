@@ -65,7 +65,9 @@ STDMETHODIMP CEditCmdFilter::Exec(const GUID* cmdGroup, DWORD cmdID, DWORD cmdex
 				}
 
 				// Tell the scrollbar to apply a marker on all occurrences of the selected word and highlights it in the code image.
-				PostMessage(m_bar->GetHwnd(), (WM_USER + 1), 0, 0);
+				// With CTRL held down, the word is pinned in the code image instead.
+				WPARAM pin = (GetKeyState(VK_CONTROL) & 0x8000) ? 1 : 0;
+				PostMessage(m_bar->GetHwnd(), (WM_USER + 1), pin, 0);
 				break;
 			}
 
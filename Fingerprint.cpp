@@ -0,0 +1,135 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#include "MetalScrollPCH.h"
+#include "Fingerprint.h"
+
+// The bulk of the data goes through 8 independent 32-bit lanes, xxHash32 style, 32 bytes at a time. The lanes
+// and the leftover bytes are then folded into a 64-bit value. The lane count is the same for all the kernels, so
+// they produce identical results.
+#define HASH_LANES					8
+#define HASH_BLOCK_SIZE				(HASH_LANES * 4)
+
+#define HASH_PRIME32_1				2654435761u
+#define HASH_PRIME32_2				2246822519u
+#define HASH_PRIME64_1				0x9e3779b185ebca87ULL
+#define HASH_PRIME64_2				0xc2b2ae3d27d4eb4fULL
+
+static inline unsigned int RotateLeft32(unsigned int x, int bits)
+{
+	return (x << bits) | (x >> (32 - bits));
+}
+
+static inline unsigned __int64 RotateLeft64(unsigned __int64 x, int bits)
+{
+	return (x << bits) | (x >> (64 - bits));
+}
+
+static void InitLanes(unsigned int* lanes, unsigned __int64 seed)
+{
+	for(int i = 0; i < HASH_LANES; ++i)
+		lanes[i] = ((unsigned int)seed ^ (unsigned int)(seed >> 32)) + HASH_PRIME32_1 * (i + 1);
+}
+
+static unsigned __int64 FinishHash(const unsigned int* lanes, const unsigned char* tail, unsigned int tailSize, unsigned int size, unsigned __int64 seed)
+{
+	unsigned __int64 hash = seed + size * HASH_PRIME64_1;
+	for(int i = 0; i < HASH_LANES; ++i)
+		hash = RotateLeft64(hash ^ (lanes[i] * HASH_PRIME64_2), 31) * HASH_PRIME64_1;
+
+	for(unsigned int i = 0; i < tailSize; ++i)
+		hash = RotateLeft64(hash ^ (tail[i] * HASH_PRIME64_1), 11) * HASH_PRIME64_2;
+
+	// Final avalanche, from MurmurHash3.
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+unsigned __int64 HashBytesPlainC(const void* data, unsigned int size, unsigned __int64 seed)
+{
+	unsigned int lanes[HASH_LANES];
+	InitLanes(lanes, seed);
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	unsigned int numBlocks = size / HASH_BLOCK_SIZE;
+	for(unsigned int block = 0; block < numBlocks; ++block, bytes += HASH_BLOCK_SIZE)
+	{
+		for(int i = 0; i < HASH_LANES; ++i)
+		{
+			unsigned int x;
+			memcpy(&x, bytes + i*4, 4);
+			lanes[i] = RotateLeft32(lanes[i] + x * HASH_PRIME32_2, 13) * HASH_PRIME32_1;
+		}
+	}
+
+	return FinishHash(lanes, bytes, size % HASH_BLOCK_SIZE, size, seed);
+}
+
+static inline __m128i HashRoundSSE41(__m128i lanes, __m128i x)
+{
+	lanes = _mm_add_epi32(lanes, _mm_mullo_epi32(x, _mm_set1_epi32((int)HASH_PRIME32_2)));
+	lanes = _mm_or_si128(_mm_slli_epi32(lanes, 13), _mm_srli_epi32(lanes, 19));
+	return _mm_mullo_epi32(lanes, _mm_set1_epi32((int)HASH_PRIME32_1));
+}
+
+unsigned __int64 HashBytesSSE41(const void* data, unsigned int size, unsigned __int64 seed)
+{
+	unsigned int lanes[HASH_LANES];
+	InitLanes(lanes, seed);
+	__m128i low = _mm_loadu_si128((const __m128i*)lanes);
+	__m128i high = _mm_loadu_si128((const __m128i*)(lanes + 4));
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	unsigned int numBlocks = size / HASH_BLOCK_SIZE;
+	for(unsigned int block = 0; block < numBlocks; ++block, bytes += HASH_BLOCK_SIZE)
+	{
+		low = HashRoundSSE41(low, _mm_loadu_si128((const __m128i*)bytes));
+		high = HashRoundSSE41(high, _mm_loadu_si128((const __m128i*)(bytes + 16)));
+	}
+
+	_mm_storeu_si128((__m128i*)lanes, low);
+	_mm_storeu_si128((__m128i*)(lanes + 4), high);
+	return FinishHash(lanes, bytes, size % HASH_BLOCK_SIZE, size, seed);
+}
+
+#if _MSC_VER >= 1700
+unsigned __int64 HashBytesAVX2(const void* data, unsigned int size, unsigned __int64 seed)
+{
+	unsigned int lanes[HASH_LANES];
+	InitLanes(lanes, seed);
+	__m256i state = _mm256_loadu_si256((const __m256i*)lanes);
+	__m256i prime1 = _mm256_set1_epi32((int)HASH_PRIME32_1);
+	__m256i prime2 = _mm256_set1_epi32((int)HASH_PRIME32_2);
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	unsigned int numBlocks = size / HASH_BLOCK_SIZE;
+	for(unsigned int block = 0; block < numBlocks; ++block, bytes += HASH_BLOCK_SIZE)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)bytes);
+		state = _mm256_add_epi32(state, _mm256_mullo_epi32(x, prime2));
+		state = _mm256_or_si256(_mm256_slli_epi32(state, 13), _mm256_srli_epi32(state, 19));
+		state = _mm256_mullo_epi32(state, prime1);
+	}
+
+	_mm256_storeu_si256((__m256i*)lanes, state);
+	_mm256_zeroupper();
+	return FinishHash(lanes, bytes, size % HASH_BLOCK_SIZE, size, seed);
+}
+#endif
@@ -0,0 +1,26 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#pragma once
+
+// 64-bit content hashes, used to tell whether the inputs of a render changed since the last one. All the
+// kernels return the same value for the same input, so fingerprints stay comparable when the dispatch level
+// changes. Chain several buffers by passing the previous hash as the seed.
+unsigned __int64 HashBytesPlainC(const void* data, unsigned int size, unsigned __int64 seed);
+unsigned __int64 HashBytesSSE41(const void* data, unsigned int size, unsigned __int64 seed);
+#if _MSC_VER >= 1700
+unsigned __int64 HashBytesAVX2(const void* data, unsigned int size, unsigned __int64 seed);
+#endif
@@ -0,0 +1,302 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+
+#include "MetalScrollPCH.h"
+#include "IdentifierIndex.h"
+#include "LineIndex.h"
+#include "CppLexer.h"
+
+// Start the hash table with this many slots, and grow it when it gets half full.
+#define MIN_TABLE_SIZE				1024
+// Throw everything away and index the text again once this many identifiers which may not occur anywhere anymore
+// (all the prefixes of a word being typed, for example) have piled up.
+#define MAX_STALE_IDENTIFIERS		4096
+
+static inline wchar_t FoldIdChar(wchar_t chr)
+{
+	return ((chr >= L'A') && (chr <= L'Z')) ? (wchar_t)(chr | 0x20) : chr;
+}
+
+static unsigned int HashIdentifier(const wchar_t* word, unsigned int length)
+{
+	unsigned int hash = 2166136261u;
+	for(unsigned int i = 0; i < length; ++i)
+		hash = (hash ^ FoldIdChar(word[i])) * 16777619u;
+	return hash;
+}
+
+IdentifierIndex::IdentifierIndex()
+{
+	InitializeCriticalSection(&m_lock);
+	m_textHash = 0;
+	m_numIdentifiersAfterRebuild = 0;
+}
+
+IdentifierIndex::~IdentifierIndex()
+{
+	DeleteCriticalSection(&m_lock);
+}
+
+void IdentifierIndex::Clear()
+{
+	EnterCriticalSection(&m_lock);
+	ClearUnlocked();
+	LeaveCriticalSection(&m_lock);
+}
+
+void IdentifierIndex::ClearUnlocked()
+{
+	// Swap with empty vectors to release the memory.
+	std::vector<Identifier>().swap(m_identifiers);
+	std::vector<wchar_t>().swap(m_chars);
+	std::vector<unsigned int>().swap(m_table);
+	std::vector<unsigned int>().swap(m_lineIds);
+	std::vector<int>().swap(m_lineNumbers);
+	std::vector<unsigned int>().swap(m_lineVersions);
+	std::vector<unsigned int>().swap(m_freeLineIds);
+	std::vector<unsigned int>().swap(m_newLineIds);
+	m_numIdentifiersAfterRebuild = 0;
+	m_textHash = 0;
+}
+
+void IdentifierIndex::SetTextHash(unsigned __int64 hash)
+{
+	EnterCriticalSection(&m_lock);
+	m_textHash = hash;
+	LeaveCriticalSection(&m_lock);
+}
+
+size_t IdentifierIndex::GetMemoryBytes() const
+{
+	size_t bytes = m_identifiers.capacity() * sizeof(Identifier);
+	for(std::vector<Identifier>::const_iterator it = m_identifiers.begin(); it != m_identifiers.end(); ++it)
+		bytes += it->occurrences.capacity() * sizeof(Occurrence);
+
+	bytes += m_chars.capacity() * sizeof(wchar_t);
+	bytes += m_table.capacity() * sizeof(unsigned int);
+	bytes += m_lineIds.capacity() * sizeof(unsigned int);
+	bytes += m_lineNumbers.capacity() * sizeof(int);
+	bytes += m_lineVersions.capacity() * sizeof(unsigned int);
+	bytes += m_freeLineIds.capacity() * sizeof(unsigned int);
+	bytes += m_newLineIds.capacity() * sizeof(unsigned int);
+	return bytes;
+}
+
+unsigned int IdentifierIndex::AllocLineId()
+{
+	if(!m_freeLineIds.empty())
+	{
+		unsigned int lineId = m_freeLineIds.back();
+		m_freeLineIds.pop_back();
+		return lineId;
+	}
+
+	m_lineNumbers.push_back(0);
+	m_lineVersions.push_back(0);
+	return (unsigned int)m_lineVersions.size() - 1;
+}
+
+void IdentifierIndex::Update(const LineIndex& lineIndex, int firstLine, int endOldLine, int endNewLine)
+{
+	EnterCriticalSection(&m_lock);
+	m_textHash = 0;
+	bool wasEmpty = m_lineIds.empty();
+
+	// Retire the old lines. Bumping the version leaves their occurrences behind, to be dropped later.
+	for(int line = firstLine; line < endOldLine; ++line)
+	{
+		unsigned int lineId = m_lineIds[line];
+		++m_lineVersions[lineId];
+		m_freeLineIds.push_back(lineId);
+	}
+
+	std::vector<unsigned int>& newIds = m_newLineIds;
+	newIds.resize(endNewLine - firstLine);
+	for(int i = 0; i < endNewLine - firstLine; ++i)
+		newIds[i] = AllocLineId();
+
+	m_lineIds.erase(m_lineIds.begin() + firstLine, m_lineIds.begin() + endOldLine);
+	m_lineIds.insert(m_lineIds.begin() + firstLine, newIds.begin(), newIds.end());
+
+	// If the number of lines didn't change, only the new lines need their numbers set.
+	int endRenumber = (endNewLine == endOldLine) ? endNewLine : (int)m_lineIds.size();
+	for(int line = firstLine; line < endRenumber; ++line)
+		m_lineNumbers[m_lineIds[line]] = line;
+
+	for(int line = firstLine; line < endNewLine; ++line)
+		IndexLine(m_lineIds[line], lineIndex.GetLineStart(line), lineIndex.GetLineLength(line));
+
+	if(wasEmpty)
+		m_numIdentifiersAfterRebuild = (unsigned int)m_identifiers.size();
+	else if(m_identifiers.size() > m_numIdentifiersAfterRebuild + MAX_STALE_IDENTIFIERS)
+	{
+		ClearUnlocked();
+		m_lineIds.resize(lineIndex.GetNumLines());
+		for(int line = 0; line < lineIndex.GetNumLines(); ++line)
+		{
+			unsigned int lineId = AllocLineId();
+			m_lineIds[line] = lineId;
+			m_lineNumbers[lineId] = line;
+			IndexLine(lineId, lineIndex.GetLineStart(line), lineIndex.GetLineLength(line));
+		}
+		m_numIdentifiersAfterRebuild = (unsigned int)m_identifiers.size();
+	}
+
+	LeaveCriticalSection(&m_lock);
+}
+
+void IdentifierIndex::IndexLine(unsigned int lineId, const wchar_t* lineStart, unsigned int length)
+{
+	Occurrence occurrence;
+	occurrence.lineId = lineId;
+	occurrence.version = m_lineVersions[lineId];
+
+	const wchar_t* lineEnd = lineStart + length;
+	for(const wchar_t* chr = lineStart; chr < lineEnd; )
+	{
+		if(IsCppIdSeparator(*chr))
+		{
+			++chr;
+			continue;
+		}
+
+		const wchar_t* wordStart = chr;
+		unsigned int hash = 2166136261u;
+		for(; (chr < lineEnd) && !IsCppIdSeparator(*chr); ++chr)
+			hash = (hash ^ FoldIdChar(*chr)) * 16777619u;
+
+		Identifier& identifier = m_identifiers[Intern(wordStart, (unsigned int)(chr - wordStart), hash)];
+		occurrence.column = (unsigned int)(wordStart - lineStart);
+
+		// Make room for everything up to the next compaction at once. Compacting keeps the capacity, so a line
+		// being edited over and over stops allocating once its identifiers have been through one compaction.
+		std::vector<Occurrence>& occurrences = identifier.occurrences;
+		if(occurrences.size() == occurrences.capacity())
+			occurrences.reserve(std::max(occurrences.size() * 2, 2*(size_t)identifier.numCompacted + 16));
+		occurrences.push_back(occurrence);
+		if(identifier.occurrences.size() >= 2*identifier.numCompacted + 16)
+			Compact(identifier, m_lineVersions);
+	}
+}
+
+unsigned int IdentifierIndex::Intern(const wchar_t* word, unsigned int length, unsigned int hash)
+{
+	if(m_identifiers.size() * 2 >= m_table.size())
+		GrowTable();
+
+	unsigned int mask = (unsigned int)m_table.size() - 1;
+	unsigned int slot = hash & mask;
+	for(; m_table[slot]; slot = (slot + 1) & mask)
+	{
+		unsigned int index = m_table[slot] - 1;
+		const Identifier& identifier = m_identifiers[index];
+		if( (identifier.hash == hash) && (identifier.length == length) && !memcmp(&m_chars[identifier.offset], word, length*sizeof(wchar_t)) )
+			return index;
+	}
+
+	Identifier identifier;
+	identifier.hash = hash;
+	identifier.offset = (unsigned int)m_chars.size();
+	identifier.length = length;
+	identifier.numCompacted = 0;
+	m_chars.insert(m_chars.end(), word, word + length);
+	m_identifiers.push_back(identifier);
+	m_table[slot] = (unsigned int)m_identifiers.size();
+	return (unsigned int)m_identifiers.size() - 1;
+}
+
+void IdentifierIndex::GrowTable()
+{
+	unsigned int size = std::max((unsigned int)m_table.size() * 2, (unsigned int)MIN_TABLE_SIZE);
+	m_table.assign(size, 0);
+	unsigned int mask = size - 1;
+	for(unsigned int i = 0; i < m_identifiers.size(); ++i)
+	{
+		unsigned int slot = m_identifiers[i].hash & mask;
+		while(m_table[slot])
+			slot = (slot + 1) & mask;
+		m_table[slot] = i + 1;
+	}
+}
+
+void IdentifierIndex::Compact(Identifier& identifier, const std::vector<unsigned int>& lineVersions)
+{
+	std::vector<Occurrence>& occurrences = identifier.occurrences;
+	size_t numLive = 0;
+	for(size_t i = 0; i < occurrences.size(); ++i)
+	{
+		if(occurrences[i].version == lineVersions[occurrences[i].lineId])
+			occurrences[numLive++] = occurrences[i];
+	}
+
+	occurrences.resize(numLive);
+	identifier.numCompacted = (unsigned int)numLive;
+}
+
+bool IdentifierIndex::Find(unsigned __int64 textHash, const wchar_t* word, unsigned int length, bool caseSensitive, std::vector<Span>& spans)
+{
+	spans.clear();
+	if(!textHash || !length)
+		return false;
+	for(unsigned int i = 0; i < length; ++i)
+	{
+		if(IsCppIdSeparator(word[i]))
+			return false;
+	}
+
+	EnterCriticalSection(&m_lock);
+	if(textHash != m_textHash)
+	{
+		LeaveCriticalSection(&m_lock);
+		return false;
+	}
+
+	// Identifiers which only differ in case share a hash, so a case insensitive lookup checks all of them. They're
+	// all ASCII, so folding the letters is what _wcsnicmp() would do.
+	unsigned int hash = HashIdentifier(word, length);
+	unsigned int mask = (unsigned int)m_table.size() - 1;
+	for(unsigned int slot = hash & mask; !m_table.empty() && m_table[slot]; slot = (slot + 1) & mask)
+	{
+		Identifier& identifier = m_identifiers[m_table[slot] - 1];
+		if( (identifier.hash != hash) || (identifier.length != length) )
+			continue;
+
+		const wchar_t* chars = &m_chars[identifier.offset];
+		bool equal = true;
+		for(unsigned int i = 0; equal && (i < length); ++i)
+			equal = caseSensitive ? (chars[i] == word[i]) : (FoldIdChar(chars[i]) == FoldIdChar(word[i]));
+		if(!equal)
+			continue;
+
+		Compact(identifier, m_lineVersions);
+		for(std::vector<Occurrence>::const_iterator it = identifier.occurrences.begin(); it != identifier.occurrences.end(); ++it)
+		{
+			Span span;
+			span.line = m_lineNumbers[it->lineId];
+			span.column = it->column;
+			spans.push_back(span);
+		}
+
+		if(caseSensitive)
+			break;
+	}
+
+	LeaveCriticalSection(&m_lock);
+
+	std::sort(spans.begin(), spans.end());
+	return true;
+}
@@ -0,0 +1,103 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+
+#pragma once
+
+class LineIndex;
+
+// The positions of every identifier in a text, i.e. of every maximal run of the characters IsCppIdSeparator()
+// returns false for, grouped by identifier. The render cache keeps it up to date as lines are rendered again, so
+// that highlighting all the whole word matches of an identifier is a hash lookup instead of a search through the
+// whole text. Updates come from the render thread while lookups come from the UI thread, so both take a lock.
+class IdentifierIndex
+{
+public:
+	struct Span
+	{
+		int							line;
+		int							column;
+
+		bool operator<(const Span& other) const { return (line < other.line) || ((line == other.line) && (column < other.column)); }
+	};
+
+	IdentifierIndex();
+	~IdentifierIndex();
+
+	// Replaces the identifiers of lines [firstLine, endOldLine) with those found in [firstLine, endNewLine) of the
+	// new text. Line numbers after the changed range shift accordingly. Forgets the text hash.
+	void							Update(const LineIndex& lineIndex, int firstLine, int endOldLine, int endNewLine);
+	void							Clear();
+
+	// The hash of the text the index was last brought up to date with, so lookups can make sure the index matches
+	// the text they're looking at. 0 if unknown.
+	void							SetTextHash(unsigned __int64 hash);
+
+	// Fills spans with the positions of the identifier, sorted. Returns false if the index doesn't hold the text
+	// with the given hash or if the word isn't an identifier, in which case the text has to be searched.
+	bool							Find(unsigned __int64 textHash, const wchar_t* word, unsigned int length, bool caseSensitive, std::vector<Span>& spans);
+
+	// The heap memory held by the index. Doesn't take the lock, so only the thread doing the updates may call it.
+	size_t							GetMemoryBytes() const;
+
+private:
+	struct Occurrence
+	{
+		unsigned int				lineId;
+		// Occurrences whose version differs from the one of their line were left behind when the line changed.
+		unsigned int				version;
+		unsigned int				column;
+	};
+
+	struct Identifier
+	{
+		// FNV-1a of the identifier with the letters in lower case, so that case insensitive lookups hash the same.
+		unsigned int				hash;
+		unsigned int				offset;
+		unsigned int				length;
+		// The number of occurrences after they were last cleaned up.
+		unsigned int				numCompacted;
+		std::vector<Occurrence>		occurrences;
+	};
+
+	CRITICAL_SECTION				m_lock;
+	unsigned __int64				m_textHash;
+
+	// The identifiers, their characters, and an open addressing hash table of their indices plus one.
+	std::vector<Identifier>			m_identifiers;
+	std::vector<wchar_t>			m_chars;
+	std::vector<unsigned int>		m_table;
+	unsigned int					m_numIdentifiersAfterRebuild;
+
+	// Lines are known by ids which don't change when lines are inserted or removed before them, so that the
+	// occurrences don't need updating. The per-id tables are indexed by line id.
+	std::vector<unsigned int>		m_lineIds;
+	std::vector<int>				m_lineNumbers;
+	std::vector<unsigned int>		m_lineVersions;
+	std::vector<unsigned int>		m_freeLineIds;
+	// Scratch space for the ids of the lines being replaced.
+	std::vector<unsigned int>		m_newLineIds;
+
+	IdentifierIndex(const IdentifierIndex&);
+	IdentifierIndex&				operator=(const IdentifierIndex&);
+
+	void							ClearUnlocked();
+	unsigned int					AllocLineId();
+	void							IndexLine(unsigned int lineId, const wchar_t* lineStart, unsigned int length);
+	unsigned int					Intern(const wchar_t* word, unsigned int length, unsigned int hash);
+	void							GrowTable();
+	static void						Compact(Identifier& identifier, const std::vector<unsigned int>& lineVersions);
+};
@@ -0,0 +1,150 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#include "MetalScrollPCH.h"
+#include "LineIndex.h"
+#include "CpuDispatch.h"
+
+// Called for every CR, LF or null character found by the scanners. Returns true at the end of the text.
+static inline bool ProcessLineBreak(const wchar_t* text, const wchar_t* chr, std::vector<unsigned int>& lineStarts)
+{
+	if(*chr == 0)
+		return true;
+
+	if(*chr == L'\r')
+		lineStarts.push_back((unsigned int)(chr - text) + ((chr[1] == L'\n') ? 2 : 1));
+	else if( (chr == text) || (chr[-1] != L'\r') )
+		lineStarts.push_back((unsigned int)(chr - text) + 1);
+
+	// An LF preceded by CR was handled together with the CR.
+	return false;
+}
+
+unsigned int FindLineStartsPlainC(const wchar_t* text, std::vector<unsigned int>& lineStarts)
+{
+	for(const wchar_t* chr = text; ; ++chr)
+	{
+		if( (*chr <= L'\r') && ((*chr == L'\r') || (*chr == L'\n') || (*chr == 0)) && ProcessLineBreak(text, chr, lineStarts) )
+			return (unsigned int)(chr - text);
+	}
+}
+
+unsigned int FindLineStartsSSE2(const wchar_t* text, std::vector<unsigned int>& lineStarts)
+{
+	// Go one character at a time until the pointer is aligned, so that the vector loads can't cross into an
+	// unmapped page after the end of the text.
+	const wchar_t* chr = text;
+	for(; ((UINT_PTR)chr & 15) != 0; ++chr)
+	{
+		if( (*chr <= L'\r') && ((*chr == L'\r') || (*chr == L'\n') || (*chr == 0)) && ProcessLineBreak(text, chr, lineStarts) )
+			return (unsigned int)(chr - text);
+	}
+
+	__m128i cr = _mm_set1_epi16(L'\r');
+	__m128i lf = _mm_set1_epi16(L'\n');
+	__m128i zero = _mm_setzero_si128();
+	for(; ; chr += 8)
+	{
+		__m128i chars = _mm_load_si128((const __m128i*)chr);
+		__m128i hits = _mm_or_si128(_mm_cmpeq_epi16(chars, cr), _mm_cmpeq_epi16(chars, lf));
+		hits = _mm_or_si128(hits, _mm_cmpeq_epi16(chars, zero));
+
+		// Two mask bits per character.
+		unsigned int mask = _mm_movemask_epi8(hits);
+		while(mask)
+		{
+			unsigned long bit;
+			_BitScanForward(&bit, mask);
+			const wchar_t* hit = chr + bit / 2;
+			if(ProcessLineBreak(text, hit, lineStarts))
+				return (unsigned int)(hit - text);
+			mask &= ~(3u << bit);
+		}
+	}
+}
+
+#if _MSC_VER >= 1700
+
+// Same as the SSE2 version, 16 characters at a time.
+unsigned int FindLineStartsAVX2(const wchar_t* text, std::vector<unsigned int>& lineStarts)
+{
+	const wchar_t* chr = text;
+	for(; ((UINT_PTR)chr & 31) != 0; ++chr)
+	{
+		if( (*chr <= L'\r') && ((*chr == L'\r') || (*chr == L'\n') || (*chr == 0)) && ProcessLineBreak(text, chr, lineStarts) )
+			return (unsigned int)(chr - text);
+	}
+
+	__m256i cr = _mm256_set1_epi16(L'\r');
+	__m256i lf = _mm256_set1_epi16(L'\n');
+	__m256i zero = _mm256_setzero_si256();
+	for(; ; chr += 16)
+	{
+		__m256i chars = _mm256_load_si256((const __m256i*)chr);
+		__m256i hits = _mm256_or_si256(_mm256_cmpeq_epi16(chars, cr), _mm256_cmpeq_epi16(chars, lf));
+		hits = _mm256_or_si256(hits, _mm256_cmpeq_epi16(chars, zero));
+
+		unsigned int mask = _mm256_movemask_epi8(hits);
+		while(mask)
+		{
+			unsigned long bit;
+			_BitScanForward(&bit, mask);
+			const wchar_t* hit = chr + bit / 2;
+			if(ProcessLineBreak(text, hit, lineStarts))
+			{
+				_mm256_zeroupper();
+				return (unsigned int)(hit - text);
+			}
+			mask &= ~(3u << bit);
+		}
+	}
+}
+
+#endif
+
+void LineIndex::Build(const wchar_t* text)
+{
+	m_text = text;
+	m_lineStarts.resize(1);
+	m_lineStarts[0] = 0;
+
+	m_textLength = g_kernels.findLineStarts(text, m_lineStarts);
+}
+
+void LineIndex::Release()
+{
+	m_text = 0;
+	m_textLength = 0;
+	std::vector<unsigned int>().swap(m_lineStarts);
+}
+
+unsigned int LineIndex::GetLineLength(int line) const
+{
+	unsigned int start = m_lineStarts[line];
+	if(line + 1 >= (int)m_lineStarts.size())
+		return m_textLength - start;
+
+	unsigned int end = m_lineStarts[line + 1] - 1;
+	if( (m_text[end] == L'\n') && (end > start) && (m_text[end - 1] == L'\r') )
+		--end;
+	return end - start;
+}
+
+int LineIndex::GetLineFromOffset(unsigned int offset) const
+{
+	std::vector<unsigned int>::const_iterator it = std::upper_bound(m_lineStarts.begin(), m_lineStarts.end(), offset);
+	return int(it - m_lineStarts.begin()) - 1;
+}
@@ -0,0 +1,52 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#pragma once
+
+// The offsets at which the lines of a null-terminated text start. Lines end with CRLF, a lone CR or a lone LF,
+// the same as in the editor, so a text with N line breaks has N + 1 lines.
+class LineIndex
+{
+public:
+	LineIndex() : m_text(0), m_textLength(0) {}
+
+	// Building again reuses the memory of the last build.
+	void							Build(const wchar_t* text);
+	void							Release();
+	size_t							GetMemoryBytes() const { return m_lineStarts.capacity() * sizeof(unsigned int); }
+
+	int								GetNumLines() const { return (int)m_lineStarts.size(); }
+	unsigned int					GetTextLength() const { return m_textLength; }
+	unsigned int					GetLineOffset(int line) const { return m_lineStarts[line]; }
+	const wchar_t*					GetLineStart(int line) const { return m_text + m_lineStarts[line]; }
+	// The number of characters in the line, not counting the line break.
+	unsigned int					GetLineLength(int line) const;
+	// The line containing the character at the given offset.
+	int								GetLineFromOffset(unsigned int offset) const;
+
+private:
+	const wchar_t*					m_text;
+	unsigned int					m_textLength;
+	std::vector<unsigned int>		m_lineStarts;
+};
+
+// Line break scanners for the dispatch table. They append the start of every line after the first one, and return
+// the length of the text.
+unsigned int FindLineStartsPlainC(const wchar_t* text, std::vector<unsigned int>& lineStarts);
+unsigned int FindLineStartsSSE2(const wchar_t* text, std::vector<unsigned int>& lineStarts);
+#if _MSC_VER >= 1700
+unsigned int FindLineStartsAVX2(const wchar_t* text, std::vector<unsigned int>& lineStarts);
+#endif
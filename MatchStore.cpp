@@ -0,0 +1,166 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+
+#include "MetalScrollPCH.h"
+#include "MatchStore.h"
+
+std::vector<BufferMatches*>		BufferMatches::s_matches;
+
+static bool SameSpan(const MatchStore::Span& a, const MatchStore::Span& b)
+{
+	return (a.line == b.line) && (a.column == b.column);
+}
+
+void MatchStore::Assign(const std::vector<Span>& spans, unsigned int length)
+{
+	m_spans = spans;
+	m_length = length;
+}
+
+void MatchStore::Clear()
+{
+	// Give the memory back, a common word can have lots of matches.
+	std::vector<Span>().swap(m_spans);
+	m_length = 0;
+}
+
+void MatchStore::AdjustForEdit(const TextLineChange& change)
+{
+	if(m_spans.empty())
+		return;
+
+	// Skip the spans which end before the edit. A span which ends right where the edit starts is left alone,
+	// like the editor does with markers.
+	Span editStart = { change.iStartLine, change.iStartIndex };
+	std::vector<Span>::iterator first = std::lower_bound(m_spans.begin(), m_spans.end(), editStart);
+	if( (first != m_spans.begin()) && ((first - 1)->line == editStart.line) &&
+		((first - 1)->column + (int)m_length > editStart.column) )
+	{
+		--first;
+	}
+
+	// Drop the ones which start inside the replaced text, or which the edit starts inside of.
+	std::vector<Span>::iterator last = first;
+	while( (last != m_spans.end()) && ((last->line < change.iOldEndLine) ||
+		   ((last->line == change.iOldEndLine) && (last->column < change.iOldEndIndex))) )
+	{
+		++last;
+	}
+	first = m_spans.erase(first, last);
+
+	// The rest move with the end of the edit. Only the ones on its last line change columns.
+	int lineDelta = change.iNewEndLine - change.iOldEndLine;
+	int columnDelta = change.iNewEndIndex - change.iOldEndIndex;
+	for(std::vector<Span>::iterator it = first; it != m_spans.end(); ++it)
+	{
+		if(it->line == change.iOldEndLine)
+			it->column += columnDelta;
+		else if(lineDelta == 0)
+			break;
+		it->line += lineDelta;
+	}
+}
+
+bool MatchStore::ReplaceLines(int firstLine, int endLine, const std::vector<Span>& spans)
+{
+	size_t first, end;
+	GetLineRange(firstLine, endLine, &first, &end);
+	if( (end - first == spans.size()) && std::equal(spans.begin(), spans.end(), m_spans.begin() + first, SameSpan) )
+		return false;
+
+	m_spans.erase(m_spans.begin() + first, m_spans.begin() + end);
+	m_spans.insert(m_spans.begin() + first, spans.begin(), spans.end());
+	return true;
+}
+
+void MatchStore::GetLineRange(int firstLine, int endLine, size_t* first, size_t* end) const
+{
+	Span firstSpan = { firstLine, 0 };
+	Span endSpan = { endLine, 0 };
+	*first = std::lower_bound(m_spans.begin(), m_spans.end(), firstSpan) - m_spans.begin();
+	*end = std::lower_bound(m_spans.begin(), m_spans.end(), endSpan) - m_spans.begin();
+}
+
+void MatchStore::GetHighlights(LineList& lines, HighlightList& storage) const
+{
+	// The spans are sorted, so the list of each line can be built by appending.
+	storage.resize(m_spans.size());
+	Highlight* prev = 0;
+	int prevLine = -1;
+	for(size_t i = 0; i < m_spans.size(); ++i)
+	{
+		const Span& span = m_spans[i];
+		if(span.line >= (int)lines.size())
+			break;
+
+		Highlight* h = &storage[i];
+		h->start = span.column;
+		h->end = span.column + m_length;
+		h->slot = 0;
+		h->next = 0;
+
+		// Add a marker on the right to make it easier to see.
+		LineInfo& line = lines[span.line];
+		if(span.line != prevLine)
+		{
+			line.flags |= LineFlag_Match;
+			line.highlights = h;
+		}
+		else
+			prev->next = h;
+
+		prev = h;
+		prevLine = span.line;
+	}
+}
+
+BufferMatches* BufferMatches::Acquire(const void* document)
+{
+	for(std::vector<BufferMatches*>::iterator it = s_matches.begin(); it != s_matches.end(); ++it)
+	{
+		if((*it)->m_document == document)
+		{
+			++(*it)->m_refCount;
+			return *it;
+		}
+	}
+
+	BufferMatches* matches = new BufferMatches;
+	matches->m_document = document;
+	s_matches.push_back(matches);
+	return matches;
+}
+
+void BufferMatches::Release()
+{
+	if(--m_refCount > 0)
+		return;
+
+	s_matches.erase(std::find(s_matches.begin(), s_matches.end(), this));
+	delete this;
+}
+
+void BufferMatches::ReleaseMarkers()
+{
+	for(std::vector<IVsTextLineMarker*>::iterator it = markers.begin(); it != markers.end(); ++it)
+	{
+		(*it)->Invalidate();
+		(*it)->Release();
+	}
+
+	markers.clear();
+}
@@ -0,0 +1,88 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+
+#pragma once
+
+#include "TextFormatting.h"
+
+// The matches of the highlighted word, kept by the bars instead of as one editor marker per match. They're moved
+// along with the text as the buffer reports edits, so only the lines an edit touched need searching again. The
+// editor only gets real markers for the matches around the lines it shows.
+class MatchStore
+{
+public:
+	struct Span
+	{
+		int							line;
+		int							column;
+
+		bool operator<(const Span& other) const { return (line < other.line) || ((line == other.line) && (column < other.column)); }
+	};
+
+	MatchStore() : m_length(0) {}
+
+	// The spans must be sorted and can't overlap. All of them are the given number of characters long.
+	void							Assign(const std::vector<Span>& spans, unsigned int length);
+	void							Clear();
+	bool							IsEmpty() const { return m_spans.empty(); }
+	unsigned int					GetLength() const { return m_length; }
+	const std::vector<Span>&		GetSpans() const { return m_spans; }
+
+	// Moves the spans after an edit and drops the ones the edit cut into.
+	void							AdjustForEdit(const TextLineChange& change);
+	// Replaces the spans on lines [firstLine, endLine) with the given ones, which must be sorted and on those lines.
+	// Returns false if they were the same already.
+	bool							ReplaceLines(int firstLine, int endLine, const std::vector<Span>& spans);
+
+	// The range of spans on lines [firstLine, endLine).
+	void							GetLineRange(int firstLine, int endLine, size_t* first, size_t* end) const;
+
+	// Adds the spans to the highlights of the lines, the way GetLineInfo() does for the editor markers.
+	void							GetHighlights(LineList& lines, HighlightList& storage) const;
+
+private:
+	std::vector<Span>				m_spans;
+	unsigned int					m_length;
+};
+
+// The highlighted word of a text buffer and its matches, shared by the bars of all the views showing the buffer, so
+// that a word highlighted in one pane of a split window shows in the others as well. The editor markers are shared
+// too; each bar asks for the ones around the lines its view shows. Only used on the UI thread.
+class BufferMatches
+{
+public:
+	// Returns the matches for the buffer, creating them if needed, with a reference added. Bars which can't follow
+	// the edits of their buffer pass themselves as the document, so they don't share.
+	static BufferMatches*			Acquire(const void* document);
+	void							Release();
+
+	MatchStore						store;
+	CComBSTR						word;
+	std::vector<IVsTextLineMarker*>	markers;
+
+	// Invalidates the editor markers.
+	void							ReleaseMarkers();
+
+private:
+	BufferMatches() : m_refCount(1) {}
+	~BufferMatches() { ReleaseMarkers(); }
+
+	const void*						m_document;
+	int								m_refCount;
+
+	static std::vector<BufferMatches*>	s_matches;
+};
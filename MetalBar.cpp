@@ -18,13 +18,25 @@
 #include "MetalBar.h"
 #include "OptionsDialog.h"
 #include "EditCmdFilter.h"
+#include "BufferEvents.h"
 #include "Utils.h"
 #include "CodePreview.h"
 #include "CppLexer.h"
 #include "TextFormatting.h"
+#include "RenderPipeline.h"
+#include "LineIndex.h"
+#include "Benchmark.h"
+#include "CpuDispatch.h"
+#include "TextSearch.h"
 
 #define REFRESH_CODE_TIMER_ID		1
 #define REFRESH_CODE_INTERVAL		2000
+#define SAFETY_REFRESH_INTERVAL		30000
+#define BUFFER_CHANGED_TIMER_ID		2
+#define BUFFER_CHANGED_DELAY		250
+
+#define WM_CODE_IMG_READY			(WM_USER + 3)
+#define WM_UPDATE_MATCH_MARKERS		(WM_USER + 4)
 
 extern HWND							g_mainVSHwnd;
 extern long							g_highlightMarkerType;
@@ -36,6 +48,7 @@ unsigned int MetalBar::s_characterColor;
 unsigned int MetalBar::s_commentColor;
 unsigned int MetalBar::s_cursorColor;
 unsigned int MetalBar::s_matchColor;
+unsigned int MetalBar::s_pinnedColors[MAX_PINNED_WORDS];
 unsigned int MetalBar::s_modifiedLineColor;
 unsigned int MetalBar::s_unsavedLineColor;
 unsigned int MetalBar::s_breakpointColor;
@@ -47,13 +60,26 @@ unsigned int MetalBar::s_codePreviewBg;
 unsigned int MetalBar::s_codePreviewFg;
 unsigned int MetalBar::s_codePreviewWidth;
 unsigned int MetalBar::s_codePreviewHeight;
+unsigned int MetalBar::s_renderMemoryBudget;
 unsigned int MetalBar::s_enabled;
+unsigned int MetalBar::s_runBenchmarks;
+unsigned int MetalBar::s_maxCpuLevel;
+unsigned int MetalBar::s_fingerprintHits = 0;
+unsigned int MetalBar::s_fingerprintMisses = 0;
+unsigned int MetalBar::s_paintCounter = 0;
+unsigned int MetalBar::s_evictions = 0;
 
 std::set<MetalBar*> MetalBar::s_bars;
 
 static CodePreview					g_codePreviewWnd;
 static bool							g_previewShown = false;
 
+// The pinned words, empty for free slots, and the matcher built from them. The matcher is rebuilt when the words or
+// the search options change.
+static CComBSTR						g_pinnedWords[MAX_PINNED_WORDS];
+static unsigned int					g_nextPinnedSlot = 0;
+static WordMatcher*					g_pinnedMatcher = 0;
+
 MetalBar::MetalBar(ScrollbarHandles& handles, IVsTextView* view)
 {
 	m_handles = handles;
@@ -62,15 +88,24 @@ MetalBar::MetalBar(ScrollbarHandles& handles, IVsTextView* view)
 	m_view->AddRef();
 	m_numLines = 0;
 
+	m_pipeline = new RenderPipeline(m_handles.vert, WM_CODE_IMG_READY);
 	m_codeImg = 0;
 	m_codeImgHeight = 0;
 	m_codeImgDirty = true;
+	m_codeImgFingerprint = 0;
+	m_requestedHeight = 0;
 	m_imgDC = 0;
+	m_imgDCDefaultBmp = 0;
 	m_backBufferImg = 0;
 	m_backBufferDC = 0;
 	m_backBufferBits = 0;
 	m_backBufferWidth = 0;
 	m_backBufferHeight = 0;
+	m_cursorBandValid = false;
+	m_cursorBandTop = 0;
+	m_cursorBandHeight = 0;
+	m_cursorBandColor = 0;
+	m_lastPaint = 0;
 
 	m_pageSize = 1;
 	m_scrollPos = 0;
@@ -78,7 +113,21 @@ MetalBar::MetalBar(ScrollbarHandles& handles, IVsTextView* view)
 	m_scrollMax = 1;
 	m_dragging = false;
 
+	m_textHash = 0;
+	m_textChanged = true;
+	m_markedFirstLine = 0;
+	m_markedEndLine = 0;
+	m_markerUpdatePending = false;
+	m_markersStale = false;
+
 	m_editCmdFilter = CEditCmdFilter::AttachFilter(this);
+	m_changePending = false;
+	m_bufferEvents = CBufferEvents::Attach(this);
+
+	// The views of a buffer share the highlighted word, as long as the buffer events keep its matches up to date.
+	CComPtr<IVsTextLines> buffer;
+	HRESULT hr = m_bufferEvents ? m_view->GetBuffer(&buffer) : E_FAIL;
+	m_matches = BufferMatches::Acquire((SUCCEEDED(hr) && buffer) ? (const void*)buffer.p : this);
 
 	s_bars.insert(this);
 
@@ -100,16 +149,26 @@ MetalBar::~MetalBar()
 		m_editCmdFilter->RemoveFilter();
 		m_editCmdFilter->Release();
 	}
+	if(m_bufferEvents)
+	{
+		m_bufferEvents->Detach();
+		m_bufferEvents->Release();
+	}
+	// The markers stay as long as another bar of the buffer is using them.
+	m_matches->Release();
 	if(m_view)
 		m_view->Release();
 
-	// Free the paint stuff.
-	if(m_codeImg)
-		DeleteObject(m_codeImg);
+	// Free the paint stuff. Bitmaps can't be deleted while they're selected into a DC, so the DCs go first.
+	ReleaseCodeImg();
+	m_pipeline->Detach();
+	m_pipeline->Release();
+	if(m_imgDC)
+		DeleteDC(m_imgDC);
+	if(m_backBufferDC)
+		DeleteDC(m_backBufferDC);
 	if(m_backBufferImg)
 		DeleteObject(m_backBufferImg);
-	if(m_backBufferDC)
-		DeleteObject(m_backBufferDC);
 }
 
 void MetalBar::RemoveWndProcHook()
@@ -250,10 +309,10 @@ void MetalBar::ShowCodePreview()
 	CComPtr<IVsTextLines> buffer;
 	CComBSTR text;
 	long numLines;
-	if(!GetBufferAndText(&buffer, &text, &numLines))
+	if(!GetViewText(m_view, &buffer, &text, &numLines))
 		return;
 
-	g_codePreviewWnd.Show(m_handles.vert, m_view, buffer, text, numLines);
+	g_codePreviewWnd.Show(m_handles.vert, m_view, buffer, text, numLines, GetMatchStore());
 
 	g_previewShown = true;
 	OnTrackPreview();
@@ -278,10 +337,22 @@ LRESULT MetalBar::WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
 		case (WM_USER + 1):
 		{
 			// This message is sent by the command filter to inform us we should highlight words matching
-			// the current selection.
+			// the current selection. A non-zero wparam means the word should be pinned instead.
+			if(wparam)
+			{
+				PinSelectedWord();
+				return 0;
+			}
 			HighlightMatchingWords();
-			m_codeImgDirty = true;
-			InvalidateRect(hwnd, 0, 0);
+			RefreshMatchingBars();
+			return 0;
+		}
+
+		case WM_UPDATE_MATCH_MARKERS:
+		{
+			m_markerUpdatePending = false;
+			UpdateMatchMarkers(m_markersStale);
+			m_markersStale = false;
 			return 0;
 		}
 
@@ -293,14 +364,17 @@ LRESULT MetalBar::WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
 		case (WM_USER + 2):
 		{
 			// Right-clicking on the bar or pressing ESC removes the matching word markers. ESC key presses
-			// are sent to us by the command filter as WM_USER+2 messages.
+			// are sent to us by the command filter as WM_USER+2 messages. If no word is highlighted, the
+			// pinned words are cleared instead.
 			CComPtr<IVsTextLines> buffer;
 			HRESULT hr = m_view->GetBuffer(&buffer);
 			if(SUCCEEDED(hr) && buffer)
 			{
+				bool hadHighlight = (m_matches->word.Length() > 0);
 				RemoveWordHighlight(buffer);
-				m_codeImgDirty = true;
-				InvalidateRect(hwnd, 0, 0);
+				RefreshMatchingBars();
+				if(!hadHighlight)
+					ClearPinnedWords();
 			}
 			// Don't let the default window procedure see right button up events, or it will display the
 			// Windows scrollbar menu (scroll here, page up, page down etc.).
@@ -308,6 +382,14 @@ LRESULT MetalBar::WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
 		}
 	}
 
+	// The markers of the matches have to follow the view as it scrolls, whether the bar is enabled or not. Move
+	// them once the view is done scrolling, instead of from the middle of it.
+	if( ((message == SBM_SETSCROLLINFO) || (message == SBM_SETPOS)) && !m_matches->store.IsEmpty() && !m_markerUpdatePending )
+	{
+		m_markerUpdatePending = true;
+		PostMessage(hwnd, WM_UPDATE_MATCH_MARKERS, 0, 0);
+	}
+
 	if(!s_enabled)
 		return CallWindowProc(m_oldProc, hwnd, message, wparam, lparam);
 
@@ -319,7 +401,7 @@ LRESULT MetalBar::WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
 			HDC hdc = BeginPaint(hwnd, &ps);
 			if(hdc)
 			{
-				OnPaint(hdc);
+				OnPaint(hdc, ps.rcPaint);
 				EndPaint(hwnd, &ps);
 			}
 			return 0;
@@ -369,7 +451,11 @@ LRESULT MetalBar::WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
 			LRESULT res = CallWindowProc(m_oldProc, hwnd, message, 0, lparam);
 			if(wparam)
 			{
-				InvalidateRect(hwnd, 0, TRUE);
+				// Unless the image needs refreshing, only the page marker has to be painted again.
+				if(m_codeImgDirty)
+					InvalidateRect(hwnd, 0, TRUE);
+				else
+					InvalidateCursor();
 				UpdateWindow(hwnd);
 			}
 			
@@ -379,7 +465,7 @@ LRESULT MetalBar::WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
 		case SBM_SETPOS:
 		{
 			m_scrollPos = (int)wparam;
-			InvalidateRect(hwnd, 0, FALSE);
+			InvalidateCursor();
 			return m_scrollPos;
 		}
 
@@ -449,13 +535,28 @@ LRESULT MetalBar::WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
 			return 0;
 		}
 
+		case WM_CODE_IMG_READY:
+		{
+			// The render thread has finished a new code image, or couldn't rescale the old one and needs the text.
+			if(wparam)
+			{
+				m_codeImgFingerprint = 0;
+				m_requestedHeight = 0;
+				m_codeImgDirty = true;
+			}
+			InvalidateRect(hwnd, 0, 0);
+			return 0;
+		}
+
 		case WM_TIMER:
 		{
-			if(wparam != REFRESH_CODE_TIMER_ID)
+			if(wparam == BUFFER_CHANGED_TIMER_ID)
+				m_changePending = false;
+			else if(wparam != REFRESH_CODE_TIMER_ID)
 				break;
 
 			// Remove the timer, invalidate the code image and repaint the control.
-			KillTimer(hwnd, REFRESH_CODE_TIMER_ID);
+			KillTimer(hwnd, (UINT_PTR)wparam);
 			m_codeImgDirty = true;
 			InvalidateRect(hwnd, 0, 0);
 			return 0;
@@ -474,194 +575,176 @@ LRESULT FAR PASCAL MetalBar::WndProcHelper(HWND hwnd, UINT message, WPARAM wpara
 	return bar->WndProc(hwnd, message, wparam, lparam);
 }
 
-bool MetalBar::GetBufferAndText(IVsTextLines** buffer, BSTR* text, long* numLines)
+void MetalBar::OnBufferChanged(bool textChanged)
 {
-	HRESULT hr = m_view->GetBuffer(buffer);
-	if(FAILED(hr) || !*buffer)
-	{
-		static bool warningShown = false;
-		if(!warningShown)
-		{
-			Log("MetalScroll: Failed to get buffer for view 0x%p.", m_view);
-			warningShown = true;
-		}
-		return false;
-	}
+	if(textChanged)
+		m_textChanged = true;
 
-	hr = (*buffer)->GetLineCount(numLines);
-	if(FAILED(hr))
-		return false;
-
-	long numCharsLastLine;
-	hr = (*buffer)->GetLengthOfLine(*numLines - 1, &numCharsLastLine);
-	if(FAILED(hr))
-		return false;
-
-	hr = (*buffer)->GetLineText(0, 0, *numLines - 1, numCharsLastLine, text);
-	return SUCCEEDED(hr) && (*text);
-}
-
-void MetalBar::PaintLineFlags(unsigned int* img, int line, int imgHeight, unsigned int flags)
-{
-	int startLine = std::max(0, line - 2);
-	int endLine = std::min(imgHeight, line + 3);
+	// Edits arrive one keystroke at a time, so collect them for a little while instead of taking a new text
+	// snapshot for each one. Don't restart the timer if it's already running, or we'd never refresh while the
+	// user keeps typing.
+	if(m_changePending)
+		return;
 
-	// Left margin flags.
-	if( (flags & LineFlag_ChangedUnsaved) || (flags & LineFlag_ChangedSaved) )
+	// Disabled bars don't see WM_TIMER, so just remember to refresh when they're enabled again.
+	if(!s_enabled)
 	{
-		unsigned int color = (flags & LineFlag_ChangedUnsaved) ? s_unsavedLineColor : s_modifiedLineColor;
-		for(int i = startLine; i < endLine; ++i)
-		{
-			for(int j = 0; j < 3; ++j)
-				img[i*s_barWidth + j] = color;
-		}
+		m_codeImgDirty = true;
+		return;
 	}
 
-	// Right margin flags.
-	unsigned int color;
-	if(flags & LineFlag_Match)
-		color = s_matchColor;
-	else if(flags & LineFlag_Breakpoint)
-		color = s_breakpointColor;
-	else if(flags & LineFlag_Bookmark)
-		color = s_bookmarkColor;
-	else
-		return;
+	m_changePending = true;
+	SetTimer(m_handles.vert, BUFFER_CHANGED_TIMER_ID, BUFFER_CHANGED_DELAY, 0);
+}
 
-	for(int i = startLine; i < endLine; ++i)
+void MetalBar::OnTextChanged(const TextLineChange& change)
+{
+	if(GetMatchStore() && AppliesEditsToMatches())
 	{
-		for(int j = s_barWidth - 5; j < (int)s_barWidth; ++j)
-			img[i*s_barWidth + j] = color;
+		m_matches->store.AdjustForEdit(change);
+		if(m_matches->word)
+			SearchChangedLines(change.iStartLine, change.iNewEndLine + 1);
 	}
+	OnBufferChanged(true);
 }
 
-struct BarRenderOp : public RenderOperator
+void MetalBar::GetBarSettings(BarSettings& settings)
 {
-	typedef std::vector<std::pair<unsigned int, unsigned int> > MarkedLineList;
-
-	BarRenderOp(std::vector<unsigned int>& _imgBuffer, MarkedLineList& _markedLines) : imgBuffer(_imgBuffer), markedLines(_markedLines) {}
+	settings.width = s_barWidth;
+	settings.whitespaceColor = s_whitespaceColor;
+	settings.upperCaseColor = s_upperCaseColor;
+	settings.characterColor = s_characterColor;
+	settings.commentColor = s_commentColor;
+	settings.matchColor = s_matchColor;
+	settings.modifiedLineColor = s_modifiedLineColor;
+	settings.unsavedLineColor = s_unsavedLineColor;
+	settings.breakpointColor = s_breakpointColor;
+	settings.bookmarkColor = s_bookmarkColor;
+	for(int i = 0; i < MAX_PINNED_WORDS; ++i)
+		settings.pinnedColors[i] = s_pinnedColors[i];
+}
 
-	void Init(int numLines)
+static WordMatcher* GetPinnedMatcher()
+{
+	bool caseSensitive = (MetalBar::s_caseSensitive != 0);
+	bool wholeWord = (MetalBar::s_wholeWordOnly != 0);
+	if( g_pinnedMatcher && ((g_pinnedMatcher->IsCaseSensitive() != caseSensitive) || (g_pinnedMatcher->IsWholeWord() != wholeWord)) )
 	{
-		imgBuffer.reserve(numLines*MetalBar::s_barWidth);
-		imgBuffer.resize(MetalBar::s_barWidth);
-		markedLines.reserve(numLines);
+		g_pinnedMatcher->Release();
+		g_pinnedMatcher = 0;
 	}
 
-	void EndLine(int line, int lastColumn, unsigned int lineFlags, bool textEnd)
+	if(!g_pinnedMatcher)
 	{
-		// Fill the remaining pixels with the whitespace color.
-		for(int i = lastColumn; i < (int)MetalBar::s_barWidth; ++i)
-			imgBuffer[line*MetalBar::s_barWidth + i] = MetalBar::s_whitespaceColor;
-
-		if(lineFlags)
-			markedLines.push_back(std::pair<unsigned int, unsigned int>(line, lineFlags));
+		WordMatcher* matcher = new WordMatcher(caseSensitive, wholeWord);
+		bool empty = true;
+		for(unsigned int i = 0; i < MAX_PINNED_WORDS; ++i)
+		{
+			if(g_pinnedWords[i].Length() > 0)
+			{
+				matcher->AddWord(g_pinnedWords[i], g_pinnedWords[i].Length(), i);
+				empty = false;
+			}
+		}
 
-		if(!textEnd)
+		if(empty)
 		{
-			// Advance the image pointer.
-			imgBuffer.resize((line + 2) * MetalBar::s_barWidth);
+			matcher->Release();
+			return 0;
 		}
+
+		matcher->Build();
+		g_pinnedMatcher = matcher;
 	}
 
-	void RenderSpaces(int line, int column, int count)
+	return g_pinnedMatcher;
+}
+
+void MetalBar::RefreshCodeImg(int barHeight)
+{
+	// Take a snapshot of the text and hand it to the render thread. The current image stays on screen until
+	// the new one is ready.
+	RenderSnapshot* snapshot = new RenderSnapshot;
+	ViewTextSource source(m_view, GetMatchStore());
+	if(!source.GetSnapshot(*snapshot))
 	{
-		for(int i = column; (i < column + count) && (i < (int)MetalBar::s_barWidth); ++i)
-			imgBuffer[line*MetalBar::s_barWidth + i] = MetalBar::s_whitespaceColor;
+		delete snapshot;
+		return;
 	}
 
-	void RenderCharacter(int line, int column, wchar_t chr, unsigned int flags)
+	GetBarSettings(snapshot->settings);
+	snapshot->barHeight = barHeight;
+	snapshot->pinnedWords = GetPinnedMatcher();
+	if(snapshot->pinnedWords)
+		snapshot->pinnedWords->AddRef();
+
+	// Most refresh triggers (the safety timer, scroll range messages) don't mean the image would come out
+	// any different, so don't render it again if nothing it depends on has changed. If only the height is
+	// different, scaling the last image is enough.
+	unsigned __int64 fingerprint = GetSnapshotFingerprint(*snapshot);
+	m_textHash = snapshot->textHash;
+	m_textChanged = false;
+	if(m_codeImg && (fingerprint == m_codeImgFingerprint))
 	{
-		if(column >= (int)MetalBar::s_barWidth)
-			return;
-
-		unsigned int color;
-		if(flags & TextFlag_Highlight)
-			color = MetalBar::s_matchColor;
-		else if(flags & TextFlag_Comment)
-			color = MetalBar::s_commentColor;
-		else if( (chr >= 'A') && (chr <= 'Z') )
-			color = MetalBar::s_upperCaseColor;
-		else
-			color = MetalBar::s_characterColor;
-
-		imgBuffer[line*MetalBar::s_barWidth + column] = color;
+		++s_fingerprintHits;
+		delete snapshot;
+		if(barHeight != m_requestedHeight)
+			RescaleCodeImg(barHeight);
+		return;
 	}
 
-	std::vector<unsigned int>& imgBuffer;
-	MarkedLineList& markedLines;
-};
+	++s_fingerprintMisses;
+	m_codeImgFingerprint = fingerprint;
+	m_requestedHeight = barHeight;
+	m_pipeline->Submit(snapshot);
+}
 
-void MetalBar::RefreshCodeImg(int barHeight)
+void MetalBar::RescaleCodeImg(int barHeight)
 {
-	// Get the text buffer.
-	CComPtr<IVsTextLines> buffer;
-	CComBSTR text;
-	long numLines;
-	if(!GetBufferAndText(&buffer, &text, &numLines))
-		return;
+	m_requestedHeight = barHeight;
+	m_pipeline->Rescale(barHeight);
+}
 
-	// Paint the code representation.
-	std::vector<unsigned int> imgBuffer;
-	BarRenderOp::MarkedLineList markedLines;
-	BarRenderOp renderOp(imgBuffer, markedLines);
-	m_numLines = RenderText(renderOp, m_view, buffer, text, numLines);
-	m_codeImgHeight = m_numLines < barHeight ? m_numLines : barHeight;
+bool MetalBar::UpdateCodeImg()
+{
+	CodeImage* img = m_pipeline->TakeImage();
+	if(!img)
+		return false;
 
-	// Create a bitmap and put the code image inside, scaling it if necessary.
-	if(m_codeImg)
-		DeleteObject(m_codeImg);
-
-	BITMAPINFO bi;
-	memset(&bi, 0, sizeof(bi));
-	bi.bmiHeader.biSize = sizeof(bi.bmiHeader);
-	bi.bmiHeader.biWidth = s_barWidth;
-	bi.bmiHeader.biHeight = m_codeImgHeight;
-	bi.bmiHeader.biPlanes = 1;
-	bi.bmiHeader.biBitCount = 32;
-	bi.bmiHeader.biCompression = BI_RGB;
-	unsigned int* bmpBits = 0;
-	m_codeImg = CreateDIBSection(0, &bi, DIB_RGB_COLORS, (void**)&bmpBits, 0, 0);
-
-	float lineScaleFactor;
-	if(m_numLines < barHeight)
-	{
-		lineScaleFactor = 1.0f;
-		// Flip the image while copying it.
-		std::vector<unsigned int>::iterator line1 = imgBuffer.begin();
-		unsigned int* line2 = bmpBits + (m_numLines - 1)*s_barWidth;
-		for(int i = 0; i < m_numLines; ++i)
-		{
-			std::copy(line1, line1 + s_barWidth, line2);
-			line1 += s_barWidth;
-			line2 -= s_barWidth;
-		}
-	}
-	else
-	{
-		lineScaleFactor = 1.0f * barHeight / m_numLines;
-		// Scale.
-		FlipScaleImageVertically(bmpBits, barHeight, &imgBuffer[0], m_numLines, s_barWidth);
-	}
+	// The render thread painted the image straight into its DIB section, so all that's left is to select it. The
+	// old image goes back to the pipeline to be painted over next time.
+	ReleaseCodeImg();
+	m_codeImg = img;
+	m_numLines = img->numLines;
+	m_codeImgHeight = img->height;
+	m_cursorBandValid = false;
 
-	// Paint the line flags directly on the final image, which might have been scaled. By doing it in
-	// a separate pass (instead of painting the markers while generating the code image) we get rid of
-	// a bunch of complications and we make sure that the size of the markers stays fixed regardless
-	// of image scaling.
-	for(int i = 0; i < (int)markedLines.size(); ++i)
+	if(!m_imgDC)
+		m_imgDC = CreateCompatibleDC(0);
+	if(img->bitmap)
 	{
-		int imgLine = int(lineScaleFactor * markedLines[i].first);
-		// Flip it, since BMPs are upside down.
-		imgLine = m_codeImgHeight - imgLine - 1;
-		PaintLineFlags(bmpBits, imgLine, m_codeImgHeight, markedLines[i].second);
+		HGDIOBJ prevBmp = SelectObject(m_imgDC, img->bitmap);
+		if(!m_imgDCDefaultBmp)
+			m_imgDCDefaultBmp = prevBmp;
 	}
 
-	if(!m_imgDC)
-		m_imgDC = CreateCompatibleDC(0);
-	SelectObject(m_imgDC, m_codeImg);
+	return true;
+}
+
+void MetalBar::ReleaseCodeImg()
+{
+	if(!m_codeImg)
+		return;
+
+	if(m_codeImg->bitmap && m_imgDCDefaultBmp)
+		SelectObject(m_imgDC, m_imgDCDefaultBmp);
+	// Make sure GDI is done with the bitmap before the render thread writes to it again.
+	GdiFlush();
+	m_pipeline->RecycleImage(m_codeImg);
+	m_codeImg = 0;
 }
 
-void MetalBar::OnPaint(HDC ctrlDC)
+void MetalBar::OnPaint(HDC ctrlDC, const RECT& updateRect)
 {
 	BLENDFUNCTION blendFunc;
 	blendFunc.BlendOp = AC_SRC_OVER;
@@ -676,10 +759,11 @@ void MetalBar::OnPaint(HDC ctrlDC)
 	if(!m_backBufferDC)
 		m_backBufferDC = CreateCompatibleDC(ctrlDC);
 
+	bool newImages = false;
 	if(!m_backBufferImg || (m_backBufferWidth != s_barWidth) || (m_backBufferHeight != (unsigned int)barHeight))
 	{
-		if(m_backBufferImg)
-			DeleteObject(m_backBufferImg);
+		newImages = true;
+		HBITMAP oldBackBufferImg = m_backBufferImg;
 
 		BITMAPINFO bi;
 		memset(&bi, 0, sizeof(bi));
@@ -690,30 +774,77 @@ void MetalBar::OnPaint(HDC ctrlDC)
 		bi.bmiHeader.biBitCount = 32;
 		bi.bmiHeader.biCompression = BI_RGB;
 		m_backBufferImg = CreateDIBSection(0, &bi, DIB_RGB_COLORS, (void**)&m_backBufferBits, 0, 0);
+		// Select the new bitmap before deleting the old one, which can't be deleted while it's selected.
 		SelectObject(m_backBufferDC, m_backBufferImg);
+		if(oldBackBufferImg)
+			DeleteObject(oldBackBufferImg);
 		m_backBufferWidth = s_barWidth;
 		m_backBufferHeight = barHeight;
+		m_cursorBandValid = false;
 	}
 
-	// If the bar height has changed and we have more lines than vertical pixels, redraw the code image.
-	if( (m_numLines > barHeight) && (m_codeImgHeight != barHeight) )
-		m_codeImgDirty = true;
+	// Pick up the image produced by the render thread, if there's a new one.
+	if(UpdateCodeImg())
+		newImages = true;
+	m_lastPaint = ++s_paintCounter;
+	// Memory use only grows when we get a new image or back buffer, so that's the only time the budget is checked.
+	if(newImages)
+		EnforceImageBudget(this);
+
+	// If the bar height has changed and we have more lines than vertical pixels, the text is the same, so the
+	// render thread only has to scale the image it already has.
+	if( (m_numLines > barHeight) && (m_codeImgHeight != barHeight) && (m_requestedHeight != barHeight) )
+	{
+		if(m_codeImg && !m_codeImgDirty)
+			RescaleCodeImg(barHeight);
+		else
+			m_codeImgDirty = true;
+	}
 
-	// Don't refresh the image while the preview is shown.
-	if(!m_codeImg || (m_codeImgDirty && !g_previewShown))
+	// Don't refresh the image while the preview is shown, unless we don't have one at all.
+	if(m_codeImgDirty && (!m_codeImg || !g_previewShown))
 	{
 		m_codeImgDirty = false;
 		RefreshCodeImg(barHeight);
-		// Re-arm the refresh timer.
-		SetTimer(m_handles.vert, REFRESH_CODE_TIMER_ID, REFRESH_CODE_INTERVAL, 0);
+		// Re-arm the refresh timer. When we get change notifications from the buffer, it's only a safety net for
+		// changes which don't come through them, so it can fire much less often.
+		SetTimer(m_handles.vert, REFRESH_CODE_TIMER_ID, m_bufferEvents ? SAFETY_REFRESH_INTERVAL : REFRESH_CODE_INTERVAL, 0);
 	}
 
-	// Blit the code image and fill the remaining space with the whitespace color.
-	BitBlt(m_backBufferDC, clRect.left, clRect.top, s_barWidth, m_codeImgHeight, m_imgDC, 0, 0, SRCCOPY);
-	RECT remainingRect = clRect;
-	remainingRect.top += m_codeImgHeight;
-	FillSolidRect(m_backBufferDC, s_whitespaceColor, remainingRect);
+	int cursorTop, cursorHeight;
+	GetCursorBand(barHeight, &cursorTop, &cursorHeight);
 
+	// The rows of the back buffer which change in this paint.
+	RECT changedRect = clRect;
+	changedRect.bottom = changedRect.top;
+	if(!m_cursorBandValid)
+	{
+		// Something under the page marker has changed, so build the whole back buffer again.
+		RestoreBackBufferRows(0, barHeight);
+		BlendCursorBand(cursorTop, cursorHeight);
+		changedRect = clRect;
+	}
+	else if( (cursorTop != m_cursorBandTop) || (cursorHeight != m_cursorBandHeight) || (s_cursorColor != m_cursorBandColor) )
+	{
+		// Only the page marker has moved. Put back the rows it covered and blend the ones it covers now.
+		changedRect.top = clRect.top + std::min(cursorTop, m_cursorBandTop);
+		changedRect.bottom = clRect.top + std::max(cursorTop + cursorHeight, m_cursorBandTop + m_cursorBandHeight);
+		RestoreBackBufferRows(m_cursorBandTop, m_cursorBandHeight);
+		BlendCursorBand(cursorTop, cursorHeight);
+	}
+
+	// Painting is clipped to the update region, so if it doesn't cover everything that changed (the scroll position
+	// can change without an invalidation), ask for another paint.
+	if( (changedRect.bottom > changedRect.top) && ((changedRect.top < updateRect.top) || (changedRect.bottom > updateRect.bottom)) )
+		InvalidateRect(m_handles.vert, &changedRect, FALSE);
+
+	// Blit the part of the backbuffer which needs painting onto the control.
+	const RECT& rc = updateRect;
+	BitBlt(ctrlDC, rc.left, rc.top, rc.right - rc.left, rc.bottom - rc.top, m_backBufferDC, rc.left - clRect.left, rc.top - clRect.top, SRCCOPY);
+}
+
+void MetalBar::GetCursorBand(int barHeight, int* top, int* height)
+{
 	// Compute the size and position of the current page marker.
 	int range = m_scrollMax - m_scrollMin - m_pageSize + 2;
 	int cursor = m_scrollPos - m_scrollMin;
@@ -723,31 +854,166 @@ void MetalBar::OnPaint(HDC ctrlDC)
 	normalizedPage = std::max(15, normalizedPage);
 	if(normalizedPage > barHeight)
 		normalizedPage = barHeight;
-	if(clRect.top + normalizedCursor + normalizedPage > clRect.bottom)
+	if(normalizedCursor + normalizedPage > barHeight)
 		normalizedCursor = barHeight - normalizedPage;
 
+	*top = normalizedCursor;
+	*height = normalizedPage;
+}
+
+void MetalBar::RestoreBackBufferRows(int top, int height)
+{
+	// Blit the code image and fill the space below it with the whitespace color.
+	int imgEnd = std::min(top + height, m_codeImgHeight);
+	if(m_codeImg && (imgEnd > top))
+		BitBlt(m_backBufferDC, 0, top, s_barWidth, imgEnd - top, m_imgDC, 0, top, SRCCOPY);
+
+	RECT remainingRect;
+	remainingRect.left = 0;
+	remainingRect.right = s_barWidth;
+	remainingRect.top = std::max(top, m_codeImgHeight);
+	remainingRect.bottom = top + height;
+	if(remainingRect.bottom > remainingRect.top)
+		FillSolidRect(m_backBufferDC, s_whitespaceColor, remainingRect);
+}
+
+void MetalBar::BlendCursorBand(int top, int height)
+{
+	// GDI might still be writing to the back buffer, and we're about to touch its pixels directly.
+	GdiFlush();
+
 	// Overlay the current page marker. Since the bitmap is upside down, we must flip the cursor.
-	unsigned char opacity = (unsigned char)(s_cursorColor >> 24);
-	unsigned char cursorColor[3] =
+	unsigned int* cursorStart = m_backBufferBits + (m_backBufferHeight - top - height) * s_barWidth;
+	g_kernels.blendCursor(cursorStart, height * s_barWidth, s_cursorColor);
+
+	m_cursorBandValid = true;
+	m_cursorBandTop = top;
+	m_cursorBandHeight = height;
+	m_cursorBandColor = s_cursorColor;
+}
+
+void MetalBar::InvalidateCursor()
+{
+	HWND hwnd = m_handles.vert;
+	if(!m_cursorBandValid)
 	{
-		s_cursorColor & 0xff,
-		(s_cursorColor >> 8) & 0xff,
-		(s_cursorColor >> 16) & 0xff
-	};
+		InvalidateRect(hwnd, 0, FALSE);
+		return;
+	}
+
+	RECT clRect;
+	GetClientRect(hwnd, &clRect);
+	int top, height;
+	GetCursorBand(clRect.bottom - clRect.top, &top, &height);
+	if( (top == m_cursorBandTop) && (height == m_cursorBandHeight) )
+		return;
+
+	// Only the rows under the old and the new page marker change.
+	RECT oldRect = clRect;
+	oldRect.top = clRect.top + m_cursorBandTop;
+	oldRect.bottom = oldRect.top + m_cursorBandHeight;
+	InvalidateRect(hwnd, &oldRect, FALSE);
+
+	RECT newRect = clRect;
+	newRect.top = clRect.top + top;
+	newRect.bottom = newRect.top + height;
+	InvalidateRect(hwnd, &newRect, FALSE);
+}
+
+unsigned int MetalBar::GetImageBytes(const void** modelKey, unsigned int* modelBytes) const
+{
+	unsigned int bytes = m_backBufferWidth * m_backBufferHeight * 4;
+	if(m_codeImg)
+		bytes += m_codeImg->width * m_codeImg->height * 4;
+	return bytes + m_pipeline->GetMemoryBytes(modelKey, modelBytes);
+}
+
+unsigned int MetalBar::GetResidentBytes()
+{
+	// Views of the same buffer share a model. Their figures may have been published at different times, so keep the
+	// largest one.
+	std::map<const void*, unsigned int> models;
+	unsigned int total = 0;
+	for(std::set<MetalBar*>::iterator it = s_bars.begin(); it != s_bars.end(); ++it)
+	{
+		const void* modelKey;
+		unsigned int modelBytes;
+		total += (*it)->GetImageBytes(&modelKey, &modelBytes);
+		if(modelKey)
+		{
+			unsigned int& counted = models[modelKey];
+			counted = std::max(counted, modelBytes);
+		}
+	}
+
+	for(std::map<const void*, unsigned int>::iterator it = models.begin(); it != models.end(); ++it)
+		total += it->second;
+	return total;
+}
+
+void MetalBar::EvictImages()
+{
+	ReleaseCodeImg();
+	m_pipeline->Trim();
+
+	if(m_imgDC)
+		DeleteDC(m_imgDC);
+	if(m_backBufferDC)
+		DeleteDC(m_backBufferDC);
+	if(m_backBufferImg)
+		DeleteObject(m_backBufferImg);
+	m_imgDC = 0;
+	m_imgDCDefaultBmp = 0;
+	m_backBufferDC = 0;
+	m_backBufferImg = 0;
+	m_backBufferBits = 0;
+	m_backBufferWidth = 0;
+	m_backBufferHeight = 0;
 
-	unsigned char* end = (unsigned char*)(m_backBufferBits + (barHeight - normalizedCursor) * s_barWidth);
-	unsigned char* pixel = end - normalizedPage * s_barWidth * 4;
-	for(; pixel < end; pixel += 4)
+	// Render everything again on the next paint.
+	m_codeImgHeight = 0;
+	m_codeImgDirty = true;
+	m_codeImgFingerprint = 0;
+	m_requestedHeight = 0;
+	m_cursorBandValid = false;
+}
+
+void MetalBar::EnforceImageBudget(MetalBar* current)
+{
+	unsigned int total = GetResidentBytes();
+	// Keep the budget in bytes within 32 bits.
+	unsigned int budget = std::min(s_renderMemoryBudget, 4095u) * 1024 * 1024;
+	unsigned int numEvicted = 0;
+	while(total > budget)
 	{
-		for(int i = 0; i < 3; ++i)
+		// Evict the least recently painted bar which isn't on screen.
+		MetalBar* victim = 0;
+		for(std::set<MetalBar*>::iterator it = s_bars.begin(); it != s_bars.end(); ++it)
 		{
-			int p = (opacity*pixel[i])/255 + cursorColor[i];
-			pixel[i] = (p <= 255) ? (unsigned char)p : 255;
+			MetalBar* bar = *it;
+			const void* modelKey;
+			unsigned int modelBytes;
+			if( (bar == current) || IsWindowVisible(bar->m_handles.vert) || (!bar->GetImageBytes(&modelKey, &modelBytes) && !modelKey) )
+				continue;
+			if(!victim || (bar->m_lastPaint < victim->m_lastPaint))
+				victim = bar;
 		}
+
+		if(!victim)
+			break;
+
+		// Evicting a bar doesn't free a model another view still uses, so count again rather than subtracting.
+		victim->EvictImages();
+		total = GetResidentBytes();
+		++numEvicted;
 	}
 
-	// Blit the backbuffer onto the control.
-	BitBlt(ctrlDC, clRect.left, clRect.top, s_barWidth, barHeight, m_backBufferDC, 0, 0, SRCCOPY);
+	if(numEvicted)
+	{
+		s_evictions += numEvicted;
+		Log("MetalScroll: evicted the images of %u hidden bars, %u KB resident in %u bars, %u evictions so far.\n",
+			numEvicted, total / 1024, (unsigned int)s_bars.size(), s_evictions);
+	}
 }
 
 void MetalBar::ResetSettings()
@@ -770,7 +1036,11 @@ void MetalBar::ResetSettings()
 	s_codePreviewFg = 0xff000000;
 	s_codePreviewWidth = 80;
 	s_codePreviewHeight = 15;
+	s_renderMemoryBudget = 48;
 	s_enabled = TRUE;
+	s_pinnedColors[0] = 0xff00c000;
+	s_pinnedColors[1] = 0xffc000c0;
+	s_pinnedColors[2] = 0xff00a0ff;
 }
 
 bool MetalBar::ReadRegInt(unsigned int* to, HKEY key, const char* name)
@@ -792,6 +1062,8 @@ void MetalBar::ReadSettings()
 {
 	// Make sure we have sane defaults, in case stuff is missing.
 	ResetSettings();
+	s_runBenchmarks = FALSE;
+	s_maxCpuLevel = CpuLevel_Count;
 
 	HKEY key;
 	if(RegOpenKeyExA(HKEY_CURRENT_USER, "Software\\Griffin Software\\MetalScroll", 0, KEY_QUERY_VALUE, &key) != ERROR_SUCCESS)
@@ -815,7 +1087,13 @@ void MetalBar::ReadSettings()
 	ReadRegInt(&s_codePreviewBg, key, "CodePreviewBg");
 	ReadRegInt(&s_codePreviewWidth, key, "CodePreviewWidth");
 	ReadRegInt(&s_codePreviewHeight, key, "CodePreviewHeight");
+	ReadRegInt(&s_renderMemoryBudget, key, "RenderMemoryBudget");
 	ReadRegInt(&s_enabled, key, "BarEnabled");
+	ReadRegInt(&s_runBenchmarks, key, "RunBenchmarks");
+	ReadRegInt(&s_maxCpuLevel, key, "MaxCpuLevel");
+	ReadRegInt(&s_pinnedColors[0], key, "PinnedWordColor1");
+	ReadRegInt(&s_pinnedColors[1], key, "PinnedWordColor2");
+	ReadRegInt(&s_pinnedColors[2], key, "PinnedWordColor3");
 
 	RegCloseKey(key);
 }
@@ -849,6 +1127,10 @@ void MetalBar::SaveSettings()
 	WriteRegInt(key, "CodePreviewBg", s_codePreviewBg);
 	WriteRegInt(key, "CodePreviewWidth", s_codePreviewWidth);
 	WriteRegInt(key, "CodePreviewHeight", s_codePreviewHeight);
+	WriteRegInt(key, "RenderMemoryBudget", s_renderMemoryBudget);
+	WriteRegInt(key, "PinnedWordColor1", s_pinnedColors[0]);
+	WriteRegInt(key, "PinnedWordColor2", s_pinnedColors[1]);
+	WriteRegInt(key, "PinnedWordColor3", s_pinnedColors[2]);
 
 	RegCloseKey(key);
 
@@ -875,38 +1157,199 @@ void MetalBar::RemoveWordHighlight(IVsTextLines* buffer)
 		}
 	};
 
-	ProcessLineMarkers(buffer, g_highlightMarkerType, DeleteMarkerOp());
-	m_highlightWord = (wchar_t*)0;
+	// With the match store, the only markers are the ones around the visible lines.
+	if(GetMatchStore())
+		m_matches->ReleaseMarkers();
+	else
+		ProcessLineMarkers(buffer, g_highlightMarkerType, DeleteMarkerOp());
+	m_matches->store.Clear();
+	m_matches->word = (wchar_t*)0;
+}
+
+void MetalBar::SetMatches(IVsTextLines* buffer, const std::vector<MatchStore::Span>& matches, unsigned int length)
+{
+	if(!GetMatchStore())
+	{
+		// Nothing would move the matches along with the edits, so leave that to the editor.
+		for(std::vector<MatchStore::Span>::const_iterator it = matches.begin(); it != matches.end(); ++it)
+			buffer->CreateLineMarker(g_highlightMarkerType, it->line, it->column, it->line, it->column + length, 0, 0);
+		return;
+	}
+
+	m_matches->store.Assign(matches, length);
+	UpdateMatchMarkers(true);
+}
+
+// Converts a line of the view, as counted by the scroll position, to a line of the buffer. The topmost text layer
+// is what the view shows, with the collapsed regions hidden, so its lines map to the buffer through the layers.
+static int ViewLineToBufferLine(IVsTextView* view, int viewLine)
+{
+	CComQIPtr<IVsLayeredTextView> layeredView = view;
+	if(!layeredView)
+		return viewLine;
+
+	CComPtr<IVsTextLayer> layer;
+	HRESULT hr = layeredView->GetTopmostLayer(&layer);
+	if(FAILED(hr) || !layer)
+		return viewLine;
+
+	long bufferLine;
+	hr = layer->LocalLineIndexToBase(viewLine, &bufferLine);
+	return SUCCEEDED(hr) ? bufferLine : viewLine;
+}
+
+bool MetalBar::GetVisibleBufferLines(int* firstLine, int* endLine) const
+{
+	// The scroll position counts the lines the view shows, which skip the collapsed regions, so the first and the
+	// last visible line are mapped to buffer lines.
+	long minUnit, maxUnit, visibleUnits, firstVisibleUnit;
+	HRESULT hr = m_view->GetScrollInfo(SB_VERT, &minUnit, &maxUnit, &visibleUnits, &firstVisibleUnit);
+	if(FAILED(hr))
+		return false;
+
+	long lastVisibleUnit = std::max(firstVisibleUnit, std::min(firstVisibleUnit + visibleUnits - 1, maxUnit));
+	*firstLine = ViewLineToBufferLine(m_view, firstVisibleUnit);
+	*endLine = std::max(*firstLine, ViewLineToBufferLine(m_view, lastVisibleUnit)) + 1;
+	return true;
+}
+
+void MetalBar::UpdateMatchMarkers(bool force)
+{
+	const MatchStore& store = m_matches->store;
+	if(store.IsEmpty())
+	{
+		m_matches->ReleaseMarkers();
+		return;
+	}
+
+	int firstLine, endLine;
+	if(!GetVisibleBufferLines(&firstLine, &endLine))
+		return;
+	if( !force && (m_markedEndLine > m_markedFirstLine) && (firstLine >= m_markedFirstLine) && (endLine <= m_markedEndLine) )
+		return;
+
+	CComPtr<IVsTextLines> buffer;
+	HRESULT hr = m_view->GetBuffer(&buffer);
+	if(FAILED(hr) || !buffer)
+		return;
+
+	// The markers are shared with the other bars of the buffer, so they're created again for the lines around the
+	// visible ones of all of them. Marking a page above and below means scrolling by less than a page doesn't have
+	// to move the markers.
+	std::vector< std::pair<int, int> > ranges;
+	for(std::set<MetalBar*>::iterator it = s_bars.begin(); it != s_bars.end(); ++it)
+	{
+		MetalBar* bar = *it;
+		if(bar->m_matches != m_matches)
+			continue;
+
+		if(!bar->GetVisibleBufferLines(&firstLine, &endLine))
+			continue;
+		int pageSize = endLine - firstLine;
+		bar->m_markedFirstLine = std::max(0, firstLine - pageSize);
+		bar->m_markedEndLine = endLine + pageSize;
+		ranges.push_back(std::make_pair(bar->m_markedFirstLine, bar->m_markedEndLine));
+	}
+
+	// Panes showing the same part of the file mustn't get a marker each.
+	std::sort(ranges.begin(), ranges.end());
+	m_matches->ReleaseMarkers();
+	const std::vector<MatchStore::Span>& spans = store.GetSpans();
+	int length = (int)store.GetLength();
+	int markedEndLine = 0;
+	for(size_t r = 0; r < ranges.size(); ++r)
+	{
+		size_t first, end;
+		store.GetLineRange(std::max(ranges[r].first, markedEndLine), ranges[r].second, &first, &end);
+		markedEndLine = std::max(markedEndLine, ranges[r].second);
+		for(size_t i = first; i < end; ++i)
+		{
+			IVsTextLineMarker* marker = 0;
+			hr = buffer->CreateLineMarker(g_highlightMarkerType, spans[i].line, spans[i].column, spans[i].line, spans[i].column + length, 0, &marker);
+			if(SUCCEEDED(hr) && marker)
+				m_matches->markers.push_back(marker);
+		}
+	}
+}
+
+bool MetalBar::AppliesEditsToMatches() const
+{
+	for(std::set<MetalBar*>::iterator it = s_bars.begin(); it != s_bars.end(); ++it)
+	{
+		if((*it)->m_matches == m_matches)
+			return (*it == this);
+	}
+
+	return true;
+}
+
+void MetalBar::RefreshMatchingBars()
+{
+	for(std::set<MetalBar*>::iterator it = s_bars.begin(); it != s_bars.end(); ++it)
+	{
+		MetalBar* bar = *it;
+		if(bar->m_matches != m_matches)
+			continue;
+
+		bar->m_codeImgDirty = true;
+		InvalidateRect(bar->m_handles.vert, 0, 0);
+	}
+}
+
+// Appends the matches of the word in the text, which starts at the given buffer line, with the search options of
+// the highlighting. Like the editor's find, matches don't span lines.
+static void FindWordMatches(const wchar_t* text, int firstLine, const wchar_t* word, unsigned int length, std::vector<MatchStore::Span>& matches)
+{
+	LineIndex lineIndex;
+	lineIndex.Build(text);
+	SearchPattern pattern(word, length, MetalBar::s_wholeWordOnly != 0);
+	const wchar_t* (*findText)(const SearchPattern&, const wchar_t*, const wchar_t*, const wchar_t*) =
+		MetalBar::s_caseSensitive ? g_kernels.findText : g_kernels.findTextNoCase;
+	for(int line = 0; line < lineIndex.GetNumLines(); ++line)
+	{
+		const wchar_t* lineStart = lineIndex.GetLineStart(line);
+		const wchar_t* lineEnd = lineStart + lineIndex.GetLineLength(line);
+		for(const wchar_t* chr = lineStart; ; )
+		{
+			chr = findText(pattern, text, chr, lineEnd);
+			if(!chr)
+				break;
+
+			MatchStore::Span match = { firstLine + line, int(chr - lineStart) };
+			matches.push_back(match);
+			// Make sure we don't create overlapping markers.
+			chr += length;
+		}
+	}
 }
 
 void MetalBar::HighlightMatchingWords()
 {
 	CComPtr<IVsTextLines> buffer;
-	CComBSTR allText;
-	long numLines;
-	if(!GetBufferAndText(&buffer, &allText, &numLines))
+	HRESULT hr = m_view->GetBuffer(&buffer);
+	if(FAILED(hr) || !buffer)
 		return;
 
 	RemoveWordHighlight(buffer);
 
-	HRESULT hr = m_view->GetSelectedText(&m_highlightWord);
-	if(FAILED(hr) || !m_highlightWord)
+	hr = m_view->GetSelectedText(&m_matches->word);
+	if(FAILED(hr) || !m_matches->word)
 	{
-		m_highlightWord = (wchar_t*)0;
+		m_matches->word = (wchar_t*)0;
 		return;
 	}
 
-	unsigned int selTextLen = m_highlightWord.Length();
+	unsigned int selTextLen = m_matches->word.Length();
 	if(selTextLen < 1)
 	{
-		m_highlightWord = (wchar_t*)0;
+		m_matches->word = (wchar_t*)0;
 		return;
 	}
 
 	bool allSpaces = true;
 	for(unsigned int i = 0; i < selTextLen; ++i)
 	{
-		if( (m_highlightWord[i] != L'\t') && (m_highlightWord[i] != L' ') )
+		if( (m_matches->word[i] != L'\t') && (m_matches->word[i] != L' ') )
 		{
 			allSpaces = false;
 			break;
@@ -915,44 +1358,160 @@ void MetalBar::HighlightMatchingWords()
 
 	if(allSpaces)
 	{
-		m_highlightWord = (wchar_t*)0;
+		m_matches->word = (wchar_t*)0;
 		return;
 	}
 
-	int line = 0;
-	int column = 0;
-	for(wchar_t* chr = allText; *chr; ++chr)
+	// If the text hasn't changed since the last snapshot, whole word matches of an identifier can be taken from the
+	// index the render cache keeps. The buffer events are what tell us it hasn't changed.
+	std::vector<MatchStore::Span> matches;
+	std::vector<IdentifierIndex::Span> spans;
+	if( MetalBar::s_wholeWordOnly && m_bufferEvents && !m_textChanged &&
+		BufferRenderModel::FindIdentifier(buffer.p, m_textHash, m_matches->word, selTextLen, MetalBar::s_caseSensitive != 0, spans) )
 	{
-		// Check for newline.
-		if( (chr[0] == L'\r') || (chr[0] == L'\n') )
+		matches.resize(spans.size());
+		for(size_t i = 0; i < spans.size(); ++i)
 		{
-			// In case of CRLF, eat the next character.
-			if( (chr[0] == L'\r') && (chr[1] == L'\n') )
-				++chr;
-			++line;
-			column = 0;
-			continue;
+			matches[i].line = spans[i].line;
+			matches[i].column = spans[i].column;
 		}
+		SetMatches(buffer, matches, selTextLen);
+		return;
+	}
 
-		bool isFound = false;
-		if (MetalBar::s_caseSensitive)
-			isFound = (wcsncmp(chr, m_highlightWord, selTextLen) == 0);
-		else
-			isFound = (_wcsnicmp(chr, m_highlightWord, selTextLen) == 0);
+	CComBSTR allText;
+	long numLines;
+	buffer.Release();
+	if(!GetViewText(m_view, &buffer, &allText, &numLines))
+		return;
+
+	FindWordMatches(allText, 0, m_matches->word, selTextLen, matches);
+	SetMatches(buffer, matches, selTextLen);
+}
+
+void MetalBar::SearchChangedLines(int firstLine, int endLine)
+{
+	// The edit may have typed a new match, or joined an old one with identifier characters so that it's not a
+	// whole word anymore. Searching the lines it touched again takes care of both.
+	CComPtr<IVsTextLines> buffer;
+	HRESULT hr = m_view->GetBuffer(&buffer);
+	if(FAILED(hr) || !buffer)
+		return;
+
+	long lastLineLength;
+	CComBSTR text;
+	hr = buffer->GetLengthOfLine(endLine - 1, &lastLineLength);
+	if(SUCCEEDED(hr))
+		hr = buffer->GetLineText(firstLine, 0, endLine - 1, lastLineLength, &text);
+	if(FAILED(hr))
+		return;
+
+	std::vector<MatchStore::Span> matches;
+	FindWordMatches(text.m_str ? text.m_str : L"", firstLine, m_matches->word, m_matches->word.Length(), matches);
+	if(!m_matches->store.ReplaceLines(firstLine, endLine, matches))
+		return;
+
+	// Changing the editor markers from inside the buffer's change event isn't safe, so leave it for later.
+	m_markersStale = true;
+	if(!m_markerUpdatePending)
+	{
+		m_markerUpdatePending = true;
+		PostMessage(m_handles.vert, WM_UPDATE_MATCH_MARKERS, 0, 0);
+	}
+}
+
+void MetalBar::PinSelectedWord()
+{
+	CComBSTR word;
+	HRESULT hr = m_view->GetSelectedText(&word);
+	if(FAILED(hr) || !word)
+		return;
 
-		bool isValidWord = true;
-		if (MetalBar::s_wholeWordOnly)
-			isValidWord = (chr == allText || IsCppIdSeparator(chr[-1])) && IsCppIdSeparator(chr[selTextLen]);
+	// Same rules as for the highlighted word, except that the matcher can't deal with line breaks, and there's no
+	// point in building it out of huge selections.
+	unsigned int length = word.Length();
+	if( (length < 1) || (length > 256) )
+		return;
 
-		if( isFound && isValidWord )
+	bool allSpaces = true;
+	for(unsigned int i = 0; i < length; ++i)
+	{
+		if( (word[i] == L'\r') || (word[i] == L'\n') )
+			return;
+		if( (word[i] != L'\t') && (word[i] != L' ') )
+			allSpaces = false;
+	}
+
+	if(allSpaces)
+		return;
+
+	// Pinning a word again unpins it. Otherwise it goes into the first free slot, or replaces the words in the
+	// order they were pinned when there isn't one.
+	int slot = -1;
+	for(int i = 0; i < MAX_PINNED_WORDS; ++i)
+	{
+		if( (g_pinnedWords[i].Length() == length) && !wcscmp(g_pinnedWords[i], word) )
 		{
-			buffer->CreateLineMarker(g_highlightMarkerType, line, column, line, column + selTextLen, 0, 0);
-			// Make sure we don't create overlapping markers.
-			chr += selTextLen - 1;
-			column += selTextLen - 1;
+			g_pinnedWords[i] = (wchar_t*)0;
+			slot = i;
+			break;
+		}
+	}
+
+	if(slot < 0)
+	{
+		for(int i = 0; i < MAX_PINNED_WORDS; ++i)
+		{
+			if(g_pinnedWords[i].Length() == 0)
+			{
+				slot = i;
+				break;
+			}
+		}
+
+		if(slot < 0)
+		{
+			slot = g_nextPinnedSlot;
+			g_nextPinnedSlot = (g_nextPinnedSlot + 1) % MAX_PINNED_WORDS;
 		}
 
-		++column;
+		g_pinnedWords[slot] = word;
+	}
+
+	if(g_pinnedMatcher)
+		g_pinnedMatcher->Release();
+	g_pinnedMatcher = 0;
+	RefreshAllBars();
+}
+
+void MetalBar::ClearPinnedWords()
+{
+	if(!g_pinnedMatcher)
+	{
+		bool empty = true;
+		for(int i = 0; i < MAX_PINNED_WORDS; ++i)
+			empty = empty && (g_pinnedWords[i].Length() == 0);
+		if(empty)
+			return;
+	}
+
+	for(int i = 0; i < MAX_PINNED_WORDS; ++i)
+		g_pinnedWords[i] = (wchar_t*)0;
+	g_nextPinnedSlot = 0;
+
+	if(g_pinnedMatcher)
+		g_pinnedMatcher->Release();
+	g_pinnedMatcher = 0;
+	RefreshAllBars();
+}
+
+void MetalBar::RefreshAllBars()
+{
+	for(std::set<MetalBar*>::iterator it = s_bars.begin(); it != s_bars.end(); ++it)
+	{
+		MetalBar* bar = *it;
+		bar->m_codeImgDirty = true;
+		InvalidateRect(bar->m_handles.vert, 0, 0);
 	}
 }
 
@@ -960,7 +1519,12 @@ void MetalBar::Init()
 {
 	ReadSettings();
 
-	InitScaler();
+	InitCpuDispatch();
+	if(s_maxCpuLevel < (unsigned int)GetDetectedCpuLevel())
+		SetCpuLevel((CpuLevel)s_maxCpuLevel);
+	RenderPipeline::StartThread();
+	if(s_runBenchmarks && !RunBenchmarks())
+		Log("MetalScroll: some benchmarks failed.\n");
 	CodePreview::Register();
 	OptionsDialog::Init();
 
@@ -969,9 +1533,18 @@ void MetalBar::Init()
 
 void MetalBar::Uninit()
 {
+	Log("MetalScroll: skipped %u of %u code image refreshes with unchanged inputs.\n", s_fingerprintHits, s_fingerprintHits + s_fingerprintMisses);
+	Log("MetalScroll: evicted the images of hidden bars %u times.\n", s_evictions);
+
 	g_codePreviewWnd.Destroy();
 
 	RemoveAllBars();
+	RenderPipeline::StopThread();
+	if(g_pinnedMatcher)
+		g_pinnedMatcher->Release();
+	g_pinnedMatcher = 0;
+	for(int i = 0; i < MAX_PINNED_WORDS; ++i)
+		g_pinnedWords[i] = (wchar_t*)0;
 	CodePreview::Unregister();
 	OptionsDialog::Uninit();
 }
@@ -16,7 +16,13 @@
 
 #pragma once
 
+#include "MatchStore.h"
+
 class CEditCmdFilter;
+class CBufferEvents;
+class RenderPipeline;
+struct CodeImage;
+struct BarSettings;
 
 class MetalBar
 {
@@ -34,6 +40,8 @@ public:
 
 	IVsTextView*					GetView() const { return m_view; }
 	HWND							GetHwnd() const { return m_handles.vert; }
+	void							OnBufferChanged(bool textChanged);
+	void							OnTextChanged(const TextLineChange& change);
 
 	static void						Init();
 	static void						Uninit();
@@ -50,6 +58,7 @@ public:
 	static unsigned int				s_commentColor;
 	static unsigned int				s_cursorColor;
 	static unsigned int				s_matchColor;
+	static unsigned int				s_pinnedColors[MAX_PINNED_WORDS];
 	static unsigned int				s_modifiedLineColor;
 	static unsigned int				s_unsavedLineColor;
 	static unsigned int				s_breakpointColor;
@@ -61,10 +70,20 @@ public:
 	static unsigned int				s_codePreviewFg;
 	static unsigned int				s_codePreviewWidth;
 	static unsigned int				s_codePreviewHeight;
+	// In MB. When the images and render caches of all the bars take more than this, the ones which haven't been
+	// painted for the longest time and aren't visible are freed.
+	static unsigned int				s_renderMemoryBudget;
 
 private:
 	static std::set<MetalBar*>		s_bars;
 	static unsigned int				s_enabled;
+	static unsigned int				s_runBenchmarks;
+	static unsigned int				s_maxCpuLevel;
+	// How many refreshes were skipped because the render inputs hadn't changed, and how many were rendered.
+	static unsigned int				s_fingerprintHits;
+	static unsigned int				s_fingerprintMisses;
+	static unsigned int				s_paintCounter;
+	static unsigned int				s_evictions;
 
 	static bool						ReadRegInt(unsigned int* to, HKEY key, const char* name);
 	static void						WriteRegInt(HKEY key, const char* name, unsigned int val);
@@ -79,18 +98,46 @@ private:
 	IVsTextView*					m_view;
 	int								m_numLines;
 	CEditCmdFilter*					m_editCmdFilter;
-	CComBSTR						m_highlightWord;
+	CBufferEvents*					m_bufferEvents;
+	bool							m_changePending;
+	// The hash of the text in the last snapshot, and whether the buffer events reported a text change since then.
+	// While the text is known to be the same, word highlighting can use the render cache's identifier index.
+	unsigned __int64				m_textHash;
+	bool							m_textChanged;
+	// The highlighted word, shared with the other bars of the buffer. Its matches are only kept in the store when
+	// the buffer events are there to keep them up to date. The editor gets markers for the matches on lines
+	// [m_markedFirstLine, m_markedEndLine) of each bar, around the visible ones.
+	BufferMatches*					m_matches;
+	int								m_markedFirstLine;
+	int								m_markedEndLine;
+	bool							m_markerUpdatePending;
+	// Set when the matches changed in a way the editor markers don't follow by themselves, so they have to be
+	// created again.
+	bool							m_markersStale;
 
 	// Painting.
-	HBITMAP							m_codeImg;
+	RenderPipeline*					m_pipeline;
+	CodeImage*						m_codeImg;
 	int								m_codeImgHeight;
 	bool							m_codeImgDirty;
+	unsigned __int64				m_codeImgFingerprint;
+	int								m_requestedHeight;
 	HDC								m_imgDC;
+	HGDIOBJ							m_imgDCDefaultBmp;
 	HBITMAP							m_backBufferImg;
 	HDC								m_backBufferDC;
 	unsigned int*					m_backBufferBits;
 	unsigned int					m_backBufferWidth;
 	unsigned int					m_backBufferHeight;
+	// The back buffer keeps the code image with the page marker blended over these rows, in client coordinates.
+	// When only the marker moves, the rows it covered are restored from the code image instead of redrawing
+	// everything. Cleared when the code image or the back buffer change.
+	bool							m_cursorBandValid;
+	int								m_cursorBandTop;
+	int								m_cursorBandHeight;
+	unsigned int					m_cursorBandColor;
+	// The value of the paint counter the last time the bar was painted, for evicting the oldest images first.
+	unsigned int					m_lastPaint;
 
 	// Scrollbar stuff.
 	int								m_pageSize;
@@ -102,16 +149,50 @@ private:
 	void							OnDrag(bool initial);
 	void							OnTrackPreview();
 	void							ShowCodePreview();
-	void							OnPaint(HDC ctrlDC);
+	void							OnPaint(HDC ctrlDC, const RECT& updateRect);
+	void							GetCursorBand(int barHeight, int* top, int* height);
+	void							RestoreBackBufferRows(int top, int height);
+	void							BlendCursorBand(int top, int height);
+	// Invalidates the rows under the old and the new page marker, or the whole bar if the back buffer is stale.
+	void							InvalidateCursor();
 	void							AdjustSize(unsigned int requiredWidth, WINDOWPOS* vertSbPos);
 	void							RemoveWndProcHook();
 
-	bool							GetBufferAndText(IVsTextLines** buffer, BSTR* text, long* numLines);
 	void							HighlightMatchingWords();
 	void							RemoveWordHighlight(IVsTextLines* buffer);
-
-	void							PaintLineFlags(unsigned int* img, int line, int imgHeight, unsigned int flags);
+	void							SetMatches(IVsTextLines* buffer, const std::vector<MatchStore::Span>& matches, unsigned int length);
+	// Searches lines [firstLine, endLine) for the highlighted word again, after an edit.
+	void							SearchChangedLines(int firstLine, int endLine);
+	// Moves the editor markers to the matches around the visible lines of all the bars of the buffer, if they've
+	// scrolled out of this bar's marked range.
+	void							UpdateMatchMarkers(bool force);
+	bool							GetVisibleBufferLines(int* firstLine, int* endLine) const;
+	// The highlights come from the match store only if edits reach it.
+	const MatchStore*				GetMatchStore() const { return m_bufferEvents ? &m_matches->store : 0; }
+	// Each bar of the buffer gets the edit events, but the shared matches must only move once. The first bar of the
+	// buffer in the bar list does it.
+	bool							AppliesEditsToMatches() const;
+	// Redraws the bars which share the highlighted word with this one.
+	void							RefreshMatchingBars();
+	// Pins the selected word, or unpins it if it's already pinned. Pinned words are highlighted in all the bars,
+	// each with its own color, until they're cleared.
+	void							PinSelectedWord();
+	static void						ClearPinnedWords();
+	static void						RefreshAllBars();
+
+	static void						GetBarSettings(BarSettings& settings);
 	void							RefreshCodeImg(int barHeight);
+	void							RescaleCodeImg(int barHeight);
+	bool							UpdateCodeImg();
+	void							ReleaseCodeImg();
+	// Returns the memory of the bar's images and of its pipeline, not counting the shared model; see
+	// RenderPipeline::GetMemoryBytes().
+	unsigned int					GetImageBytes(const void** modelKey, unsigned int* modelBytes) const;
+	// The memory of all the bars, with every model counted once.
+	static unsigned int				GetResidentBytes();
+	// Frees the images and DCs of a bar which isn't visible. They're created again on the next paint.
+	void							EvictImages();
+	static void						EnforceImageBudget(MetalBar* current);
 
 	LRESULT							WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam);
 	static LRESULT FAR PASCAL		WndProcHelper(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam);
@@ -88,6 +88,7 @@ extern CAddInModule _AtlModule;
 
 #include <assert.h>
 #include <stdarg.h>
+#include <process.h>
 #include <vector>
 #include <set>
 #include <map>
@@ -96,3 +97,8 @@ extern CAddInModule _AtlModule;
 #include <intrin.h>
 #include <xmmintrin.h>
 #include <emmintrin.h>
+#include <tmmintrin.h>
+#include <smmintrin.h>
+#if _MSC_VER >= 1700
+#include <immintrin.h>
+#endif
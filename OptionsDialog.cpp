@@ -30,6 +30,8 @@ void OptionsDialog::InitDialog(HWND hwnd)
 	m_uppercase.Init(GetDlgItem(hwnd, IDC_UPPERCASE), MetalBar::s_upperCaseColor);
 	m_otherChars.Init(GetDlgItem(hwnd, IDC_CHARACTERS), MetalBar::s_characterColor);
 	m_matchingWord.Init(GetDlgItem(hwnd, IDC_MATCHING_WORD), MetalBar::s_matchColor);
+	for(int i = 0; i < MAX_PINNED_WORDS; ++i)
+		m_pinnedWords[i].Init(GetDlgItem(hwnd, IDC_PINNED_WORD1 + i), MetalBar::s_pinnedColors[i]);
 	m_modifLineSaved.Init(GetDlgItem(hwnd, IDC_MODIF_LINE_SAVED), MetalBar::s_modifiedLineColor);
 	m_modifLineUnsaved.Init(GetDlgItem(hwnd, IDC_MODIF_LINE_UNSAVED), MetalBar::s_unsavedLineColor);
 	m_breakpoints.Init(GetDlgItem(hwnd, IDC_BREAKPOINTS), MetalBar::s_breakpointColor);
@@ -139,6 +141,8 @@ void OptionsDialog::Execute()
 	MetalBar::s_upperCaseColor = m_uppercase.GetColor();
 	MetalBar::s_characterColor = m_otherChars.GetColor();
 	MetalBar::s_matchColor = m_matchingWord.GetColor();
+	for(int i = 0; i < MAX_PINNED_WORDS; ++i)
+		MetalBar::s_pinnedColors[i] = m_pinnedWords[i].GetColor();
 	MetalBar::s_modifiedLineColor = m_modifLineSaved.GetColor();
 	MetalBar::s_unsavedLineColor = m_modifLineUnsaved.GetColor();
 	MetalBar::s_breakpointColor = m_breakpoints.GetColor();
@@ -17,6 +17,7 @@
 #pragma once
 
 #include "ColorChip.h"
+#include "TextFormatting.h"
 
 class OptionsDialog
 {
@@ -41,6 +42,7 @@ private:
 	ColorChip					m_uppercase;
 	ColorChip					m_otherChars;
 	ColorChip					m_matchingWord;
+	ColorChip					m_pinnedWords[MAX_PINNED_WORDS];
 	ColorChip					m_modifLineSaved;
 	ColorChip					m_modifLineUnsaved;
 	ColorChip					m_cursorColor;
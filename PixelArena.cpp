@@ -0,0 +1,106 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#include "MetalScrollPCH.h"
+#include "PixelArena.h"
+
+// Above this percentage of physical memory in use, arenas give their storage back.
+#define HIGH_MEMORY_LOAD			90
+
+volatile LONG PixelArena::s_numAllocations = 0;
+
+PixelArena::PixelArena()
+{
+	m_data = 0;
+	m_size = 0;
+	m_capacity = 0;
+}
+
+PixelArena::PixelArena(const PixelArena& other)
+{
+	m_data = 0;
+	m_size = 0;
+	m_capacity = 0;
+	Append(other.m_data, other.m_size);
+}
+
+PixelArena::~PixelArena()
+{
+	free(m_data);
+}
+
+PixelArena& PixelArena::operator=(const PixelArena& other)
+{
+	if(this != &other)
+	{
+		m_size = 0;
+		Append(other.m_data, other.m_size);
+	}
+	return *this;
+}
+
+void PixelArena::Reserve(size_t capacity)
+{
+	if(capacity <= m_capacity)
+		return;
+
+	unsigned char* data = (unsigned char*)realloc(m_data, capacity);
+	if(!data)
+		throw std::bad_alloc();
+
+	InterlockedIncrement(&s_numAllocations);
+	m_data = data;
+	m_capacity = capacity;
+}
+
+void PixelArena::Resize(size_t size)
+{
+	if(size > m_capacity)
+		Reserve(std::max(size, m_capacity + m_capacity / 2));
+	m_size = size;
+}
+
+void PixelArena::Append(const unsigned char* src, size_t count)
+{
+	if(!count)
+		return;
+
+	size_t oldSize = m_size;
+	Resize(m_size + count);
+	memcpy(m_data + oldSize, src, count);
+}
+
+void PixelArena::Swap(PixelArena& other)
+{
+	std::swap(m_data, other.m_data);
+	std::swap(m_size, other.m_size);
+	std::swap(m_capacity, other.m_capacity);
+}
+
+void PixelArena::Release()
+{
+	free(m_data);
+	m_data = 0;
+	m_size = 0;
+	m_capacity = 0;
+}
+
+bool PixelArena::IsMemoryLow()
+{
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	return GlobalMemoryStatusEx(&status) && (status.dwMemoryLoad >= HIGH_MEMORY_LOAD);
+}
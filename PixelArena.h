@@ -0,0 +1,54 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#pragma once
+
+// Storage for palette images which is kept between renders. Unlike std::vector, growing it doesn't zero-fill the
+// new bytes, since the render operators overwrite every pixel anyway, and the capacity grows geometrically so that
+// word wrapping adding rows one at a time doesn't reallocate every time. The memory is only given back when the
+// system runs low on it.
+class PixelArena
+{
+public:
+	PixelArena();
+	PixelArena(const PixelArena& other);
+	~PixelArena();
+	PixelArena&						operator=(const PixelArena& other);
+
+	unsigned char*					GetData() const { return m_data; }
+	size_t							GetSize() const { return m_size; }
+	size_t							GetCapacity() const { return m_capacity; }
+
+	// The contents up to the old size are kept, anything past that is undefined.
+	void							Resize(size_t size);
+	void							Reserve(size_t capacity);
+	void							Append(const unsigned char* src, size_t count);
+	void							Swap(PixelArena& other);
+
+	// Gives the storage back to the heap. Owners call this when IsMemoryLow() says so.
+	void							Release();
+
+	static bool						IsMemoryLow();
+	// The number of times any arena went to the heap, for checking that warm renders don't allocate.
+	static LONG						GetNumAllocations() { return s_numAllocations; }
+
+private:
+	unsigned char*					m_data;
+	size_t							m_size;
+	size_t							m_capacity;
+
+	static volatile LONG			s_numAllocations;
+};
@@ -0,0 +1,420 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#include "MetalScrollPCH.h"
+#include "RenderCache.h"
+#include "LineIndex.h"
+#include "BarRenderOp.h"
+#include "RenderCore.h"
+
+// Ranges shorter than this aren't worth splitting across threads.
+#define MIN_LINES_PER_CHUNK			10000
+#define MAX_RENDER_CHUNKS			32
+
+// Replaces the oldCount elements at first with the new ones. An erase followed by an insert would move the tail
+// twice, so it's moved once with a memmove, or not at all if the count stays the same. Only for POD types.
+template<typename T>
+static void SpliceItems(std::vector<T>& items, size_t first, size_t oldCount, const T* newItems, size_t newCount)
+{
+	size_t tailCount = items.size() - first - oldCount;
+	if(newCount > oldCount)
+		items.resize(items.size() + newCount - oldCount);
+	if( (newCount != oldCount) && (tailCount > 0) )
+		memmove(&items[first + newCount], &items[first + oldCount], tailCount*sizeof(T));
+	if(newCount > 0)
+		memcpy(&items[first], newItems, newCount*sizeof(T));
+	if(newCount < oldCount)
+		items.resize(items.size() - (oldCount - newCount));
+}
+
+RenderCache::RenderCache()
+{
+	m_numVirtualLines = 0;
+	m_width = 0;
+	m_tabSize = 0;
+	m_wrapAfter = 0;
+	m_isCppLikeLanguage = false;
+	m_keywordFn = 0;
+}
+
+void RenderCache::Invalidate()
+{
+	// Swap with empty vectors to release the memory; clear() would keep it.
+	CheckpointList().swap(m_lines);
+	std::vector<unsigned char>().swap(m_image);
+	m_markedLines.clear();
+	m_numVirtualLines = 0;
+	m_identifiers.Clear();
+}
+
+size_t RenderCache::GetMemoryBytes() const
+{
+	size_t bytes = m_image.capacity();
+	bytes += m_lines.capacity() * sizeof(LineCheckpoint);
+	bytes += m_markedLines.capacity() * sizeof(MarkedLineList::value_type);
+	bytes += m_identifiers.GetMemoryBytes();
+
+	bytes += m_newRows.GetCapacity() + m_relexRows.GetCapacity();
+	bytes += m_chunks.capacity() * sizeof(RenderChunk);
+	for(std::vector<RenderChunk>::const_iterator it = m_chunks.begin(); it != m_chunks.end(); ++it)
+		bytes += it->rows.GetCapacity() + it->checkpoints.capacity() * sizeof(LineCheckpoint);
+	bytes += m_lineIndex.GetMemoryBytes();
+	bytes += m_lineStarts.capacity() * sizeof(const wchar_t*);
+	bytes += m_signatures.capacity() * sizeof(unsigned int);
+	bytes += m_newLines.capacity() * sizeof(LineCheckpoint);
+	return bytes;
+}
+
+unsigned int RenderCache::GetLineSignature(const wchar_t* lineStart, unsigned int length, const LineInfo& line)
+{
+	// FNV-1a over the characters of the line, followed by everything else which affects the way it's painted.
+	unsigned int hash = 2166136261u;
+	for(unsigned int i = 0; i < length; ++i)
+		hash = (hash ^ lineStart[i]) * 16777619u;
+
+	// The markers are painted over the scaled image, so only the hidden flag matters here.
+	hash = (hash ^ (line.flags & LineFlag_Hidden)) * 16777619u;
+	for(const Highlight* h = line.highlights; h; h = h->next)
+	{
+		hash = (hash ^ h->start) * 16777619u;
+		hash = (hash ^ h->end) * 16777619u;
+		hash = (hash ^ h->slot) * 16777619u;
+	}
+
+	return hash;
+}
+
+void RenderCache::Update(const RenderContext& ctx, LineList& lines, unsigned int width, int* firstDirtyLine, int* endDirtyLine)
+{
+	*firstDirtyLine = 0;
+	*endDirtyLine = 0;
+
+	if( (width != m_width) || (ctx.tabSize != m_tabSize) || (ctx.wrapAfter != m_wrapAfter) ||
+		(ctx.isCppLikeLanguage != m_isCppLikeLanguage) || (ctx.keywordFn != m_keywordFn) )
+	{
+		Invalidate();
+		m_width = width;
+		m_tabSize = ctx.tabSize;
+		m_wrapAfter = ctx.wrapAfter;
+		m_isCppLikeLanguage = ctx.isCppLikeLanguage;
+		m_keywordFn = ctx.keywordFn;
+	}
+
+	const wchar_t* text = ctx.text;
+	int numLines = (int)lines.size();
+
+	// Split the text into lines and compute their signatures.
+	LineIndex& lineIndex = m_lineIndex;
+	lineIndex.Build(text);
+	int newNumLines = lineIndex.GetNumLines();
+	if(numLines < newNumLines)
+	{
+		LineInfo defaultLineInfo = { 0 };
+		lines.resize(newNumLines, defaultLineInfo);
+	}
+
+	std::vector<const wchar_t*>& lineStarts = m_lineStarts;
+	std::vector<unsigned int>& signatures = m_signatures;
+	lineStarts.resize(newNumLines);
+	signatures.resize(newNumLines);
+	for(int i = 0; i < newNumLines; ++i)
+	{
+		lineStarts[i] = lineIndex.GetLineStart(i);
+		signatures[i] = GetLineSignature(lineStarts[i], lineIndex.GetLineLength(i), lines[i]);
+	}
+
+	// Find the lines which are identical at the start and at the end of the text.
+	int oldNumLines = (int)m_lines.size();
+	int maxCommon = std::min(oldNumLines, newNumLines);
+
+	int prefix = 0;
+	while( (prefix < maxCommon) && (m_lines[prefix].signature == signatures[prefix]) )
+		++prefix;
+
+	if( (prefix == oldNumLines) && (prefix == newNumLines) )
+	{
+		UpdateLineFlags(lines);
+		return;
+	}
+
+	int suffix = 0;
+	while( (suffix < maxCommon - prefix) && (m_lines[oldNumLines - suffix - 1].signature == signatures[newNumLines - suffix - 1]) )
+		++suffix;
+
+	// We need the lexer state at the start of the first line we render, so we can only start from a line which
+	// exists in the old checkpoint list.
+	int startLine = std::max(0, std::min(prefix, maxCommon - 1));
+	unsigned int lexerState = (startLine < oldNumLines) ? m_lines[startLine].entryState : LexerState_Code;
+	int firstVirtualLine = (startLine < oldNumLines) ? m_lines[startLine].firstVirtualLine : 0;
+
+	BarRenderOp renderOp(m_newRows, width);
+	size_t numChars = (newNumLines > startLine) ? size_t(lineStarts[newNumLines - 1] + lineIndex.GetLineLength(newNumLines - 1) - lineStarts[startLine]) : 0;
+	renderOp.Init(EstimateVirtualLines(newNumLines - startLine, numChars, ctx.wrapAfter));
+
+	CheckpointList& newLines = m_newLines;
+	newLines.clear();
+	int virtualLine = 0;
+	int line = startLine;
+
+	// The lines before the unchanged tail must be rendered no matter what; if there are lots of them, split the
+	// work across threads.
+	int tailStart = newNumLines - suffix;
+	if(RenderParallel(ctx, lines, lineStarts, signatures, width, startLine, tailStart, firstVirtualLine, lexerState, m_newRows, newLines, virtualLine))
+		line = tailStart;
+
+	int resumeOldLine = oldNumLines;
+	for(; line < newNumLines; ++line)
+	{
+		// Once we're inside the unchanged tail of the text and the lexer state matches the one we had before, the
+		// rest of the old image is still valid.
+		int oldLine = line - newNumLines + oldNumLines;
+		if( (line >= newNumLines - suffix) && (m_lines[oldLine].entryState == lexerState) )
+		{
+			resumeOldLine = oldLine;
+			break;
+		}
+
+		LineCheckpoint checkpoint;
+		checkpoint.signature = signatures[line];
+		checkpoint.flags = lines[line].flags;
+		checkpoint.entryState = lexerState;
+		checkpoint.firstVirtualLine = firstVirtualLine + virtualLine;
+
+		RenderLine(renderOp, ctx, lineStarts[line], lines[line], lexerState, virtualLine);
+
+		checkpoint.numVirtualLines = firstVirtualLine + virtualLine - checkpoint.firstVirtualLine;
+		newLines.push_back(checkpoint);
+	}
+
+	// Replace the old rows with the new ones.
+	int oldEndVirtualLine = (resumeOldLine < oldNumLines) ? m_lines[resumeOldLine].firstVirtualLine : m_numVirtualLines;
+	int delta = virtualLine - (oldEndVirtualLine - firstVirtualLine);
+
+	SpliceItems(m_image, firstVirtualLine*width, (oldEndVirtualLine - firstVirtualLine)*width, m_newRows.GetData(), virtualLine*width);
+
+	// Splice the checkpoints and shift the ones after the changed region.
+	for(int i = resumeOldLine; i < oldNumLines; ++i)
+		m_lines[i].firstVirtualLine += delta;
+	SpliceItems(m_lines, startLine, resumeOldLine - startLine, newLines.empty() ? 0 : &newLines[0], newLines.size());
+	m_numVirtualLines += delta;
+
+	// The lines which were rendered again are the only ones whose text may have changed.
+	m_identifiers.Update(lineIndex, startLine, resumeOldLine, line);
+
+	// The unchanged lines kept their old checkpoints, which may have different markers.
+	UpdateLineFlags(lines);
+
+	// The scratch rows are only needed during an update, so they're the first thing to go when memory is tight.
+	if(PixelArena::IsMemoryLow())
+	{
+		m_newRows.Release();
+		m_relexRows.Release();
+		std::vector<RenderChunk>().swap(m_chunks);
+		m_lineIndex.Release();
+		std::vector<const wchar_t*>().swap(m_lineStarts);
+		std::vector<unsigned int>().swap(m_signatures);
+		CheckpointList().swap(m_newLines);
+	}
+
+	*firstDirtyLine = firstVirtualLine;
+	*endDirtyLine = (delta == 0) ? firstVirtualLine + virtualLine : m_numVirtualLines;
+}
+
+void RenderCache::RenderChunkLines(RenderChunk& chunk)
+{
+	PixelArena& rows = chunk.rows;
+	BarRenderOp renderOp(rows, chunk.width);
+	const wchar_t* chunkStart = (*chunk.lineStarts)[chunk.firstLine];
+	const wchar_t* chunkEnd = (chunk.endLine < (int)chunk.lineStarts->size()) ? (*chunk.lineStarts)[chunk.endLine] : chunkStart;
+	renderOp.Init(EstimateVirtualLines(chunk.endLine - chunk.firstLine, size_t(chunkEnd - chunkStart), chunk.ctx->wrapAfter));
+
+	chunk.checkpoints.clear();
+	chunk.checkpoints.reserve(chunk.endLine - chunk.firstLine);
+
+	unsigned int lexerState = chunk.entryState;
+	int virtualLine = 0;
+	for(int line = chunk.firstLine; line < chunk.endLine; ++line)
+	{
+		LineCheckpoint checkpoint;
+		checkpoint.signature = (*chunk.signatures)[line];
+		checkpoint.flags = (*chunk.lines)[line].flags;
+		checkpoint.entryState = lexerState;
+		checkpoint.firstVirtualLine = virtualLine;
+
+		RenderLine(renderOp, *chunk.ctx, (*chunk.lineStarts)[line], (*chunk.lines)[line], lexerState, virtualLine);
+
+		checkpoint.numVirtualLines = virtualLine - checkpoint.firstVirtualLine;
+		chunk.checkpoints.push_back(checkpoint);
+	}
+
+	// Drop the row EndLine() added for the line after the chunk.
+	rows.Resize(virtualLine * chunk.width);
+	chunk.exitState = lexerState;
+	chunk.numVirtualLines = virtualLine;
+}
+
+void RenderCache::RelexChunk(RenderChunk& chunk, unsigned int entryState, PixelArena& scratch)
+{
+	// Lex the chunk again with the right entry state, but only until the state converges with the one from the
+	// first pass. The rest of the chunk was rendered correctly and only needs to be moved.
+	PixelArena& rows = scratch;
+	BarRenderOp renderOp(rows, chunk.width);
+	renderOp.Init(1);
+
+	int numChunkLines = chunk.endLine - chunk.firstLine;
+	unsigned int lexerState = entryState;
+	int virtualLine = 0;
+	int i = 0;
+	for(; (i < numChunkLines) && (chunk.checkpoints[i].entryState != lexerState); ++i)
+	{
+		int line = chunk.firstLine + i;
+		LineCheckpoint& checkpoint = chunk.checkpoints[i];
+		checkpoint.entryState = lexerState;
+		checkpoint.firstVirtualLine = virtualLine;
+
+		RenderLine(renderOp, *chunk.ctx, (*chunk.lineStarts)[line], (*chunk.lines)[line], lexerState, virtualLine);
+
+		checkpoint.numVirtualLines = virtualLine - checkpoint.firstVirtualLine;
+	}
+
+	unsigned int barWidth = chunk.width;
+	rows.Resize(virtualLine * barWidth);
+	if(i < numChunkLines)
+	{
+		int oldVirtualLine = chunk.checkpoints[i].firstVirtualLine;
+		int delta = virtualLine - oldVirtualLine;
+		rows.Append(chunk.rows.GetData() + oldVirtualLine*barWidth, (chunk.numVirtualLines - oldVirtualLine) * barWidth);
+		for(; i < numChunkLines; ++i)
+			chunk.checkpoints[i].firstVirtualLine += delta;
+		chunk.numVirtualLines += delta;
+	}
+	else
+	{
+		chunk.exitState = lexerState;
+		chunk.numVirtualLines = virtualLine;
+	}
+
+	// The chunk's old rows become the scratch space for the next relex.
+	chunk.rows.Swap(rows);
+	chunk.entryState = entryState;
+}
+
+unsigned int __stdcall RenderCache::ChunkThreadProc(void* param)
+{
+	RenderChunkLines(*(RenderChunk*)param);
+	return 0;
+}
+
+bool RenderCache::RenderParallel(const RenderContext& ctx, const LineList& lines, const std::vector<const wchar_t*>& lineStarts,
+	const std::vector<unsigned int>& signatures, unsigned int width, int firstLine, int endLine, int firstVirtualLine,
+	unsigned int& lexerState, PixelArena& rows, CheckpointList& checkpoints, int& virtualLine)
+{
+	SYSTEM_INFO sysInfo;
+	GetSystemInfo(&sysInfo);
+	int numChunks = std::min((int)sysInfo.dwNumberOfProcessors, (endLine - firstLine) / MIN_LINES_PER_CHUNK);
+	numChunks = std::min(numChunks, MAX_RENDER_CHUNKS);
+	if(numChunks < 2)
+		return false;
+
+	// Every chunk except the first guesses that it starts outside a comment. That's true for most lines, and
+	// when it isn't, the lexer usually gets back in sync at the end of the comment.
+	if((int)m_chunks.size() < numChunks)
+		m_chunks.resize(numChunks);
+	RenderChunk* chunks = &m_chunks[0];
+	int linesPerChunk = (endLine - firstLine) / numChunks;
+	for(int i = 0; i < numChunks; ++i)
+	{
+		RenderChunk& chunk = chunks[i];
+		chunk.ctx = &ctx;
+		chunk.lines = &lines;
+		chunk.lineStarts = &lineStarts;
+		chunk.signatures = &signatures;
+		chunk.width = width;
+		chunk.firstLine = firstLine + i*linesPerChunk;
+		chunk.endLine = (i == numChunks - 1) ? endLine : chunk.firstLine + linesPerChunk;
+		chunk.entryState = (i == 0) ? lexerState : LexerState_Code;
+	}
+
+	// The first chunk is lexed on this thread. Chunks for which a thread can't be created are lexed here too.
+	HANDLE threads[MAX_RENDER_CHUNKS];
+	int numThreads = 0;
+	int threadPriority = GetThreadPriority(GetCurrentThread());
+	for(int i = 1; i < numChunks; ++i)
+	{
+		HANDLE thread = (HANDLE)_beginthreadex(0, 0, ChunkThreadProc, &chunks[i], CREATE_SUSPENDED, 0);
+		if(!thread)
+		{
+			RenderChunkLines(chunks[i]);
+			continue;
+		}
+
+		SetThreadPriority(thread, threadPriority);
+		ResumeThread(thread);
+		threads[numThreads++] = thread;
+	}
+
+	RenderChunkLines(chunks[0]);
+
+	if(numThreads > 0)
+		WaitForMultipleObjects(numThreads, threads, TRUE, INFINITE);
+	for(int i = 0; i < numThreads; ++i)
+		CloseHandle(threads[i]);
+
+	// Fix the chunks which started with the wrong state, and append everything to the output.
+	rows.Resize(virtualLine * width);
+	for(int i = 0; i < numChunks; ++i)
+	{
+		RenderChunk& chunk = chunks[i];
+		if( (i > 0) && (chunk.entryState != chunks[i - 1].exitState) )
+			RelexChunk(chunk, chunks[i - 1].exitState, m_relexRows);
+
+		for(CheckpointList::iterator it = chunk.checkpoints.begin(); it != chunk.checkpoints.end(); ++it)
+		{
+			it->firstVirtualLine += firstVirtualLine + virtualLine;
+			checkpoints.push_back(*it);
+		}
+
+		rows.Append(chunk.rows.GetData(), chunk.rows.GetSize());
+		virtualLine += chunk.numVirtualLines;
+	}
+
+	// The sequential loop continues writing at the current virtual line.
+	rows.Resize((virtualLine + 1) * width);
+	lexerState = chunks[numChunks - 1].exitState;
+	return true;
+}
+
+void RenderCache::UpdateLineFlags(const LineList& lines)
+{
+	int numLines = std::min((int)m_lines.size(), (int)lines.size());
+	for(int i = 0; i < numLines; ++i)
+		m_lines[i].flags = lines[i].flags;
+
+	RebuildMarkedLines();
+}
+
+void RenderCache::RebuildMarkedLines()
+{
+	m_markedLines.clear();
+	for(CheckpointList::const_iterator it = m_lines.begin(); it != m_lines.end(); ++it)
+	{
+		if(!it->flags)
+			continue;
+
+		for(int i = 0; i < it->numVirtualLines; ++i)
+			m_markedLines.push_back(std::pair<unsigned int, unsigned int>(it->firstVirtualLine + i, it->flags));
+	}
+}
@@ -0,0 +1,131 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#pragma once
+
+#include "TextFormatting.h"
+#include "PixelArena.h"
+#include "IdentifierIndex.h"
+#include "LineIndex.h"
+
+// The code image holds one of these per pixel. The palette is only applied when producing the final image, so
+// changing the colors doesn't require rendering the text again.
+enum ColorClass
+{
+	ColorClass_Whitespace,
+	ColorClass_UpperCase,
+	ColorClass_Character,
+	ColorClass_Comment,
+	ColorClass_Match,
+	// One per pinned word, in slot order.
+	ColorClass_Pinned,
+	ColorClass_Count = ColorClass_Pinned + MAX_PINNED_WORDS
+};
+
+// Holds the full resolution code image of a buffer, along with the lexer state at the start of each line. When the
+// text changes, only the lines between the first change and the point where the lexer state converges with the old
+// state are rendered again; the rest of the image is reused.
+class RenderCache
+{
+public:
+	typedef std::vector<std::pair<unsigned int, unsigned int> > MarkedLineList;
+
+	RenderCache();
+
+	// Brings the image up to date with the text. On return, [firstDirtyLine, endDirtyLine) is the range of virtual
+	// lines which were painted again. If the number of virtual lines has changed, the range extends to the end.
+	// Lines found in the text beyond the end of the line list are appended to it.
+	void							Update(const RenderContext& ctx, LineList& lines, unsigned int width, int* firstDirtyLine, int* endDirtyLine);
+	// Picks up new line markers without looking at the text. Markers aren't part of the rendered rows, so this is
+	// enough when only they have changed. The hidden flags must be the same as the last time the cache was updated.
+	void							UpdateLineFlags(const LineList& lines);
+	void							Invalidate();
+
+	const unsigned char*			GetImage() const { return m_image.empty() ? 0 : &m_image[0]; }
+	int								GetNumVirtualLines() const { return m_numVirtualLines; }
+	const MarkedLineList&			GetMarkedLines() const { return m_markedLines; }
+	// Kept up to date with the text of the lines rendered by Update(), but not with its hash, which is up to the caller.
+	IdentifierIndex&				GetIdentifierIndex() { return m_identifiers; }
+	// The heap memory held by the cache, scratch space and identifier index included. Only the render thread may
+	// call this, since it walks the structures Update() changes.
+	size_t							GetMemoryBytes() const;
+
+private:
+	struct LineCheckpoint
+	{
+		unsigned int				signature;
+		unsigned int				flags;
+		unsigned int				entryState;
+		int							firstVirtualLine;
+		int							numVirtualLines;
+	};
+
+	typedef std::vector<LineCheckpoint>	CheckpointList;
+
+	// A range of lines lexed on its own thread.
+	struct RenderChunk
+	{
+		const RenderContext*				ctx;
+		const LineList*						lines;
+		const std::vector<const wchar_t*>*	lineStarts;
+		const std::vector<unsigned int>*	signatures;
+		unsigned int						width;
+		int									firstLine;
+		int									endLine;
+
+		// The state the chunk was lexed with, and the state at the start of the line after it.
+		unsigned int						entryState;
+		unsigned int						exitState;
+
+		// Rows and checkpoints, with virtual lines relative to the start of the chunk.
+		PixelArena							rows;
+		CheckpointList						checkpoints;
+		int									numVirtualLines;
+	};
+
+	CheckpointList					m_lines;
+	std::vector<unsigned char>		m_image;
+	MarkedLineList					m_markedLines;
+	int								m_numVirtualLines;
+	IdentifierIndex					m_identifiers;
+
+	// Scratch space for the rows being rendered and for the line tables of the new text, kept between updates so
+	// that warm updates don't allocate.
+	PixelArena						m_newRows;
+	PixelArena						m_relexRows;
+	std::vector<RenderChunk>		m_chunks;
+	LineIndex						m_lineIndex;
+	std::vector<const wchar_t*>		m_lineStarts;
+	std::vector<unsigned int>		m_signatures;
+	CheckpointList					m_newLines;
+
+	// The settings the image was rendered with. Changing any of them invalidates everything.
+	unsigned int					m_width;
+	int								m_tabSize;
+	int								m_wrapAfter;
+	bool							m_isCppLikeLanguage;
+	IsKeywordFnPtr					m_keywordFn;
+
+	static unsigned int				GetLineSignature(const wchar_t* lineStart, unsigned int length, const LineInfo& line);
+	void							RebuildMarkedLines();
+
+	bool							RenderParallel(const RenderContext& ctx, const LineList& lines, const std::vector<const wchar_t*>& lineStarts,
+										const std::vector<unsigned int>& signatures, unsigned int width, int firstLine, int endLine, int firstVirtualLine,
+										unsigned int& lexerState, PixelArena& rows, CheckpointList& checkpoints, int& virtualLine);
+	static void						RenderChunkLines(RenderChunk& chunk);
+	static void						RelexChunk(RenderChunk& chunk, unsigned int entryState, PixelArena& scratch);
+	static unsigned int __stdcall	ChunkThreadProc(void* param);
+};
@@ -0,0 +1,339 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#pragma once
+
+// The render loop, specialized at compile time for the language and for the render operator. The operator
+// is called directly when its type is known, and the plain text instantiation contains no lexer at all. The
+// RenderLine() and RenderText() functions in TextFormatting.h are the virtual dispatch versions.
+
+#include "TextFormatting.h"
+#include "CppLexer.h"
+#include "LineIndex.h"
+
+bool IsUscriptKeyword(const wchar_t* c, unsigned int l);
+
+struct CppLanguage
+{
+	static bool HasLexer() { return true; }
+	static bool IsCppLike(const RenderContext& /*ctx*/) { return true; }
+	static bool IsKeyword(const RenderContext& /*ctx*/, const wchar_t* c, unsigned int l) { return IsCppKeyword(c, l); }
+};
+
+struct UscriptLanguage
+{
+	static bool HasLexer() { return true; }
+	static bool IsCppLike(const RenderContext& /*ctx*/) { return true; }
+	static bool IsKeyword(const RenderContext& /*ctx*/, const wchar_t* c, unsigned int l) { return IsUscriptKeyword(c, l); }
+};
+
+struct PlainTextLanguage
+{
+	static bool HasLexer() { return false; }
+	static bool IsCppLike(const RenderContext& /*ctx*/) { return false; }
+	static bool IsKeyword(const RenderContext& /*ctx*/, const wchar_t* /*c*/, unsigned int /*l*/) { return false; }
+};
+
+// Takes everything from the render context.
+struct RuntimeLanguage
+{
+	static bool HasLexer() { return true; }
+	static bool IsCppLike(const RenderContext& ctx) { return ctx.isCppLikeLanguage; }
+	static bool IsKeyword(const RenderContext& ctx, const wchar_t* c, unsigned int l) { return ctx.keywordFn(c, l); }
+};
+
+// Collects consecutive characters with the same flags, or consecutive whitespace, and hands them to the render
+// operator in a single call.
+template<class Op> class RunBuilder
+{
+public:
+	RunBuilder(Op& renderOp) : m_renderOp(renderOp), m_count(0) {}
+
+	void AddCharacter(int line, int column, const wchar_t* chr, unsigned int flags)
+	{
+		if( m_count && (m_isSpace || (flags != m_flags) || (line != m_line) || (column != m_column + m_count) || (chr != m_chars + m_count)) )
+			Flush();
+
+		if(!m_count)
+		{
+			m_line = line;
+			m_column = column;
+			m_chars = chr;
+			m_flags = flags;
+			m_isSpace = false;
+		}
+		++m_count;
+	}
+
+	void AddSpaces(int line, int column, int count)
+	{
+		if( m_count && (!m_isSpace || (line != m_line) || (column != m_column + m_count)) )
+			Flush();
+
+		if(!m_count)
+		{
+			m_line = line;
+			m_column = column;
+			m_isSpace = true;
+		}
+		m_count += count;
+	}
+
+	void Flush()
+	{
+		if(!m_count)
+			return;
+
+		if(m_isSpace)
+			m_renderOp.RenderSpaces(m_line, m_column, m_count);
+		else
+			m_renderOp.RenderRun(m_line, m_column, m_chars, m_count, m_flags);
+		m_count = 0;
+	}
+
+private:
+	Op&					m_renderOp;
+	int					m_line;
+	int					m_column;
+	const wchar_t*		m_chars;
+	int					m_count;
+	unsigned int		m_flags;
+	bool				m_isSpace;
+};
+
+template<class Language, class Op>
+const wchar_t* RenderLineSpecialized(Op& renderOp, const RenderContext& ctx, const wchar_t* lineStart, const LineInfo& line, unsigned int& lexerState, int& virtualLine)
+{
+	RunBuilder<Op> runs(renderOp);
+
+	enum CommentType
+	{
+		CommentType_None,
+		CommentType_SingleLine,
+		CommentType_MultiLine
+	} commentType = (Language::HasLexer() && (lexerState == LexerState_MultiLineComment)) ? CommentType_MultiLine : CommentType_None;
+	bool inKeyword = false;
+	bool inString = false;
+
+	// Here "virtual" refers to rendered coordinates, which can differ from real text coordinates due to word wrapping,
+	// hidden text regions and tabs.
+	int virtualColumn = 0;
+	int realColumn = 0;
+	Highlight* crHighlight = line.highlights;
+	bool isLineVisible = !(line.flags & LineFlag_Hidden);
+
+	for(const wchar_t* chr = lineStart; ; ++chr)
+	{
+		// Check for a real newline, a virtual newline (due to word wrapping) or the end of the text.
+		bool isRealNewline = (chr[0] == L'\r') || (chr[0] == L'\n');
+		bool isVirtualNewline = (virtualColumn >= ctx.wrapAfter);
+		bool isTextEnd = (chr[0] == 0);
+		if(isRealNewline || isVirtualNewline || isTextEnd)
+		{
+			// The pending run must be painted before the end of line handler, which might erase part of it.
+			runs.Flush();
+
+			if(isLineVisible)
+			{
+				if(isVirtualNewline && !isRealNewline)
+				{
+					CharClass crChrClass = GetCharClass(*chr);
+					if(crChrClass != CharClass_Other)
+					{
+						// Go back looking for the beginning of the current "word", i.e. for the first character which doesn't
+						// match the class of the current character, or the (virtual) start of the line.
+						int currentWordLen = 1;
+						for(; currentWordLen <= virtualColumn; ++currentWordLen)
+						{
+							if(GetCharClass(chr[-currentWordLen]) != crChrClass)
+							{
+								--currentWordLen;
+								break;
+							}
+						}
+
+						// VS moves the entire word on the next line unless it starts on the 1st or 2nd column.
+						if(virtualColumn - currentWordLen > 1)
+						{
+							// Rewind the text so we can draw the entire wrapped word on the next line.
+							chr -= currentWordLen;
+							realColumn -= currentWordLen;
+							// Move back the virtual column so that the end of line handler can erase the
+							// part of the word we've already painted.
+							virtualColumn -= currentWordLen;
+						}
+					}
+				}
+
+				renderOp.EndLine(virtualLine, virtualColumn, line.flags, isTextEnd);
+
+				// Advance the virtual line.
+				virtualColumn = 0;
+				++virtualLine;
+			}
+
+			if(isTextEnd)
+				return 0;
+
+			if(isRealNewline)
+			{
+				// In case of CRLF, eat the next character too.
+				if( (chr[0] == L'\r') && (chr[1] == L'\n') )
+					++chr;
+
+				lexerState = (commentType == CommentType_MultiLine) ? LexerState_MultiLineComment : LexerState_Code;
+				return chr + 1;
+			}
+
+			// If it's a virtual newline, we keep processing the current character.
+		}
+
+		int numChars = 1;
+		if(*chr > L' ')
+		{
+			unsigned int textFlags = 0;
+
+			if(Language::HasLexer())
+			{
+				switch(commentType)
+				{
+					case CommentType_None:
+						if(!Language::IsCppLike(ctx))
+							break;
+
+						if( !inString && (chr[0] == L'/') && (chr[1] == L'/') )
+						{
+							textFlags |= TextFlag_Comment;
+							commentType = CommentType_SingleLine;
+							inKeyword = false;
+						}
+						else if( !inString && (chr[0] == L'/') && (chr[1] == L'*') )
+						{
+							textFlags |= TextFlag_Comment;
+							commentType = CommentType_MultiLine;
+							inKeyword = false;
+						}
+						else if(chr[0] == L'"')
+						{
+							inKeyword = false;
+							if(inString)
+							{
+								const wchar_t* backslashStart = chr - 1;
+								while( (backslashStart >= ctx.text) && (*backslashStart == L'\\') )
+									--backslashStart;
+								int numBackslashes = int(chr - backslashStart - 1);
+								if(numBackslashes % 2 == 0)
+									inString = false;
+							}
+							else
+								inString = true;
+						}
+						else if(!inKeyword && !inString && IsCppIdStart(chr[0]) && ((chr == ctx.text) || IsCppIdSeparator(chr[-1])) )
+						{
+							const wchar_t* keywordEnd = chr + 1;
+							while(!IsCppIdSeparator(*keywordEnd))
+								++keywordEnd;
+							int len = int(keywordEnd - chr);
+							inKeyword = Language::IsKeyword(ctx, chr, len);
+						}
+						else if(inKeyword && IsCppIdSeparator(chr[0]))
+							inKeyword = false;
+						break;
+
+					case CommentType_SingleLine:
+						textFlags |= TextFlag_Comment;
+						break;
+
+					case CommentType_MultiLine:
+						textFlags |= TextFlag_Comment;
+						if( (chr[-1] == L'*') && (chr[0] == L'/') )
+							commentType = CommentType_None;
+						break;
+				}
+			}
+
+			if(inKeyword)
+				textFlags |= TextFlag_Keyword;
+
+			// Advance the highlight interval, if needed.
+			while(crHighlight && (realColumn >= (int)crHighlight->end))
+				crHighlight = crHighlight->next;
+
+			// Override the color with the match color if inside a marker.
+			if(crHighlight && (realColumn >= (int)crHighlight->start))
+				textFlags |= TextFlag_Highlight | (crHighlight->slot << TextFlag_SlotShift);
+
+			if(isLineVisible)
+				runs.AddCharacter(virtualLine, virtualColumn, chr, textFlags);
+		}
+		else
+		{
+			inKeyword = false;
+
+			if(*chr == L'\t')
+				numChars = ctx.tabSize - (virtualColumn % ctx.tabSize);
+
+			if(isLineVisible)
+				runs.AddSpaces(virtualLine, virtualColumn, numChars);
+		}
+
+		++realColumn;
+		virtualColumn += numChars;
+	}
+}
+
+template<class Op>
+const wchar_t* RenderLine(Op& renderOp, const RenderContext& ctx, const wchar_t* lineStart, const LineInfo& line, unsigned int& lexerState, int& virtualLine)
+{
+	if(!ctx.isCppLikeLanguage)
+		return RenderLineSpecialized<PlainTextLanguage>(renderOp, ctx, lineStart, line, lexerState, virtualLine);
+	if(ctx.keywordFn == IsCppKeyword)
+		return RenderLineSpecialized<CppLanguage>(renderOp, ctx, lineStart, line, lexerState, virtualLine);
+	if(ctx.keywordFn == IsUscriptKeyword)
+		return RenderLineSpecialized<UscriptLanguage>(renderOp, ctx, lineStart, line, lexerState, virtualLine);
+	return RenderLineSpecialized<RuntimeLanguage>(renderOp, ctx, lineStart, line, lexerState, virtualLine);
+}
+
+template<class Op> int RenderText(Op& renderOp, IVsTextView* view, IVsTextLines* buffer, const wchar_t* text, int numLines, const MatchStore* matches)
+{
+	RenderContext ctx;
+	GetRenderContext(ctx, view, buffer, text);
+
+	if(numLines < 1)
+		numLines = 1;
+
+	LineList lines;
+	HighlightList highlightStorage;
+	GetLineInfo(lines, highlightStorage, buffer, numLines, matches);
+
+	LineIndex lineIndex;
+	lineIndex.Build(text);
+	assert(lineIndex.GetNumLines() == numLines);
+	if((int)lines.size() < lineIndex.GetNumLines())
+	{
+		LineInfo defaultLineInfo = { 0 };
+		lines.resize(lineIndex.GetNumLines(), defaultLineInfo);
+	}
+
+	renderOp.Init(numLines);
+
+	unsigned int lexerState = LexerState_Code;
+	int virtualLine = 0;
+	for(int line = 0; line < lineIndex.GetNumLines(); ++line)
+		RenderLine(renderOp, ctx, lineIndex.GetLineStart(line), lines[line], lexerState, virtualLine);
+
+	return virtualLine;
+}
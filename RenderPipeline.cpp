@@ -0,0 +1,824 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#include "MetalScrollPCH.h"
+#include "RenderPipeline.h"
+#include "BarRenderOp.h"
+#include "CpuDispatch.h"
+#include "RenderCore.h"
+#include "Utils.h"
+#include "MatchStore.h"
+
+// Images with more pixels than this are scaled while rendering instead of going through the render cache, so that
+// huge files don't keep a full resolution image around.
+#define MIN_STREAMED_IMAGE_SIZE		(16*1024*1024)
+
+static HANDLE						g_renderThread = 0;
+static HANDLE						g_renderEvent = 0;
+static volatile LONG				g_stopRenderThread = 0;
+static CRITICAL_SECTION				g_renderLock;
+static std::vector<RenderPipeline*>	g_renderQueue;
+
+std::vector<BufferRenderModel*>		BufferRenderModel::s_models;
+
+bool ViewTextSource::GetSnapshot(RenderSnapshot& snapshot)
+{
+	CComPtr<IVsTextLines> buffer;
+	long numLines;
+	if(!GetViewText(m_view, &buffer, &snapshot.text, &numLines))
+		return false;
+
+	snapshot.document = buffer.p;
+	if(m_matches && !m_matches->IsEmpty())
+		snapshot.highlightOwner = m_matches;
+	GetRenderContext(snapshot.ctx, m_view, buffer, snapshot.text);
+	GetLineInfo(snapshot.lines, snapshot.highlights, buffer, std::max(1L, numLines), m_matches);
+	return true;
+}
+
+bool StringTextSource::GetSnapshot(RenderSnapshot& snapshot)
+{
+	snapshot.text = m_text;
+	if(!snapshot.text)
+		return false;
+
+	snapshot.ctx.text = snapshot.text;
+	snapshot.ctx.tabSize = m_tabSize;
+	snapshot.ctx.wrapAfter = INT_MAX;
+	snapshot.ctx.isCppLikeLanguage = (m_keywordFn != 0);
+	snapshot.ctx.keywordFn = m_keywordFn;
+
+	// The render cache adds default entries for the lines it finds in the text.
+	snapshot.lines.clear();
+	snapshot.highlights.clear();
+	return true;
+}
+
+static void PaintLineFlags(unsigned int* img, int line, int imgHeight, unsigned int flags, const BarSettings& settings)
+{
+	int width = settings.width;
+	int startLine = std::max(0, line - 2);
+	int endLine = std::min(imgHeight, line + 3);
+
+	// Left margin flags.
+	if( (flags & LineFlag_ChangedUnsaved) || (flags & LineFlag_ChangedSaved) )
+	{
+		unsigned int color = (flags & LineFlag_ChangedUnsaved) ? settings.unsavedLineColor : settings.modifiedLineColor;
+		for(int i = startLine; i < endLine; ++i)
+		{
+			for(int j = 0; j < 3; ++j)
+				img[i*width + j] = color;
+		}
+	}
+
+	// Right margin flags.
+	unsigned int color = 0;
+	unsigned int pinnedFlags = flags / LineFlag_Pinned;
+	if(flags & LineFlag_Match)
+		color = settings.matchColor;
+	else if(pinnedFlags)
+	{
+		// Lines with more than one pinned word show the first one.
+		for(int i = MAX_PINNED_WORDS - 1; i >= 0; --i)
+		{
+			if(pinnedFlags & (1 << i))
+				color = settings.pinnedColors[i];
+		}
+	}
+	else if(flags & LineFlag_Breakpoint)
+		color = settings.breakpointColor;
+	else if(flags & LineFlag_Bookmark)
+		color = settings.bookmarkColor;
+	else
+		return;
+
+	for(int i = startLine; i < endLine; ++i)
+	{
+		for(int j = width - 5; j < width; ++j)
+			img[i*width + j] = color;
+	}
+}
+
+static void GetPalette(unsigned int* palette, const BarSettings& settings)
+{
+	palette[ColorClass_Whitespace] = settings.whitespaceColor;
+	palette[ColorClass_UpperCase] = settings.upperCaseColor;
+	palette[ColorClass_Character] = settings.characterColor;
+	palette[ColorClass_Comment] = settings.commentColor;
+	palette[ColorClass_Match] = settings.matchColor;
+	for(int i = 0; i < MAX_PINNED_WORDS; ++i)
+		palette[ColorClass_Pinned + i] = settings.pinnedColors[i];
+}
+
+static void PaintMarkedLines(CodeImage& img, const RenderCache::MarkedLineList& markedLines, float lineScaleFactor, const BarSettings& settings)
+{
+	// Paint the line flags directly on the final image, which might have been scaled. By doing it in
+	// a separate pass (instead of painting the markers while generating the code image) we get rid of
+	// a bunch of complications and we make sure that the size of the markers stays fixed regardless
+	// of image scaling.
+	for(int i = 0; i < (int)markedLines.size(); ++i)
+	{
+		int imgLine = int(lineScaleFactor * markedLines[i].first);
+		// Flip it, since the image is upside down.
+		imgLine = img.height - imgLine - 1;
+		PaintLineFlags(img.pixels, imgLine, img.height, markedLines[i].second, settings);
+	}
+}
+
+unsigned __int64 GetSnapshotFingerprint(RenderSnapshot& snapshot)
+{
+	unsigned __int64 hash = g_kernels.hashBytes(snapshot.text.m_str, (unsigned int)(snapshot.text.Length() * sizeof(wchar_t)), 0);
+	snapshot.textHash = hash;
+
+	// Flatten the hidden flags and the highlight spans, so they can be hashed in one go. The highlight count is
+	// stored in front of each line's spans to keep the layout unambiguous. The markers go in a separate list.
+	std::vector<unsigned int> lineData;
+	std::vector<unsigned int> markers;
+	lineData.reserve(snapshot.lines.size() * 2 + snapshot.highlights.size() * 2);
+	markers.reserve(snapshot.lines.size());
+	for(LineList::const_iterator it = snapshot.lines.begin(); it != snapshot.lines.end(); ++it)
+	{
+		lineData.push_back(it->flags & LineFlag_Hidden);
+		markers.push_back(it->flags & ~LineFlag_Hidden);
+		size_t countPos = lineData.size();
+		lineData.push_back(0);
+		for(const Highlight* h = it->highlights; h; h = h->next)
+		{
+			lineData.push_back(h->start);
+			lineData.push_back(h->end);
+			lineData.push_back(h->slot);
+			++lineData[countPos];
+		}
+	}
+	if(!lineData.empty())
+		hash = g_kernels.hashBytes(&lineData[0], (unsigned int)(lineData.size() * sizeof(unsigned int)), hash);
+
+	const RenderContext& ctx = snapshot.ctx;
+	int params[] = { ctx.tabSize, ctx.wrapAfter, ctx.isCppLikeLanguage, snapshot.settings.width };
+	hash = g_kernels.hashBytes(params, sizeof(params), hash);
+	hash = g_kernels.hashBytes(&ctx.keywordFn, sizeof(ctx.keywordFn), hash);
+	if(snapshot.pinnedWords)
+	{
+		unsigned __int64 pinnedHash = snapshot.pinnedWords->GetHash();
+		hash = g_kernels.hashBytes(&pinnedHash, sizeof(pinnedHash), hash);
+	}
+	snapshot.textFingerprint = hash;
+
+	if(!markers.empty())
+		hash = g_kernels.hashBytes(&markers[0], (unsigned int)(markers.size() * sizeof(unsigned int)), hash);
+	return g_kernels.hashBytes(&snapshot.settings, sizeof(snapshot.settings), hash);
+}
+
+// Matches the pinned words against the text and merges the matches into the highlights of the lines. The
+// highlights of a line must be sorted and can't overlap, so pinned matches which overlap the highlighted word or an
+// earlier pinned match are dropped.
+static void AddPinnedHighlights(RenderSnapshot& snapshot)
+{
+	std::vector<WordMatcher::Match> matches;
+	snapshot.pinnedWords->FindMatches(snapshot.text, matches);
+	if(matches.empty())
+		return;
+
+	std::sort(matches.begin(), matches.end());
+	LineList& lines = snapshot.lines;
+	if((int)lines.size() <= matches.back().line)
+	{
+		LineInfo defaultLineInfo = { 0 };
+		lines.resize(matches.back().line + 1, defaultLineInfo);
+	}
+
+	// The lines with matches get their whole list rebuilt in the new storage. Reserving it up front keeps the
+	// pointers valid; the other lines keep pointing into the old storage.
+	HighlightList& storage = snapshot.pinnedHighlights;
+	storage.clear();
+	storage.reserve(snapshot.highlights.size() + matches.size());
+	for(size_t i = 0; i < matches.size(); )
+	{
+		LineInfo& line = lines[matches[i].line];
+		const Highlight* old = line.highlights;
+		size_t firstNew = storage.size();
+		unsigned int lastEnd = 0;
+		int lineNumber = matches[i].line;
+		for(;;)
+		{
+			bool hasMatch = (i < matches.size()) && (matches[i].line == lineNumber);
+			if(!old && !hasMatch)
+				break;
+
+			Highlight h;
+			if(old && (!hasMatch || (old->start <= matches[i].start)))
+			{
+				h = *old;
+				old = old->next;
+			}
+			else
+			{
+				const WordMatcher::Match& match = matches[i++];
+				if(old && (old->start < match.end))
+					continue;
+				h.start = match.start;
+				h.end = match.end;
+				h.slot = match.id + 1;
+			}
+
+			if( (storage.size() > firstNew) && (h.start < lastEnd) )
+				continue;
+
+			if(h.slot)
+				line.flags |= LineFlag_Pinned << (h.slot - 1);
+			lastEnd = h.end;
+			h.next = 0;
+			if(storage.size() > firstNew)
+				storage.back().next = &storage.back() + 1;
+			storage.push_back(h);
+		}
+
+		line.highlights = (storage.size() > firstNew) ? &storage[firstNew] : 0;
+	}
+}
+
+CodeImage::CodeImage()
+{
+	bitmap = 0;
+	pixels = 0;
+	width = 0;
+	height = 0;
+	numLines = 0;
+}
+
+CodeImage::~CodeImage()
+{
+	if(bitmap)
+		DeleteObject(bitmap);
+}
+
+void CodeImage::Allocate(unsigned int _width, int _height)
+{
+	if(bitmap && (width == _width) && (height == _height))
+		return;
+
+	if(bitmap)
+		DeleteObject(bitmap);
+	bitmap = 0;
+	pixels = 0;
+	width = _width;
+	height = _height;
+	if( (width < 1) || (height < 1) )
+		return;
+
+	BITMAPINFO bi;
+	memset(&bi, 0, sizeof(bi));
+	bi.bmiHeader.biSize = sizeof(bi.bmiHeader);
+	bi.bmiHeader.biWidth = width;
+	bi.bmiHeader.biHeight = height;
+	bi.bmiHeader.biPlanes = 1;
+	bi.bmiHeader.biBitCount = 32;
+	bi.bmiHeader.biCompression = BI_RGB;
+	bitmap = CreateDIBSection(0, &bi, DIB_RGB_COLORS, (void**)&pixels, 0, 0);
+	if(!bitmap || !pixels)
+	{
+		if(bitmap)
+			DeleteObject(bitmap);
+		bitmap = 0;
+		pixels = 0;
+		height = 0;
+	}
+}
+
+BufferRenderModel* BufferRenderModel::Acquire(const RenderSnapshot& snapshot, const void* owner)
+{
+	const void* document = snapshot.document ? snapshot.document : owner;
+	const RenderContext& ctx = snapshot.ctx;
+
+	if(g_renderThread)
+		EnterCriticalSection(&g_renderLock);
+
+	BufferRenderModel* model = 0;
+	for(std::vector<BufferRenderModel*>::iterator it = s_models.begin(); it != s_models.end(); ++it)
+	{
+		BufferRenderModel* m = *it;
+		if( (m->m_document == document) && (m->m_highlightOwner == snapshot.highlightOwner) && (m->m_width == snapshot.settings.width) && (m->m_tabSize == ctx.tabSize) &&
+			(m->m_wrapAfter == ctx.wrapAfter) && (m->m_isCppLikeLanguage == ctx.isCppLikeLanguage) && (m->m_keywordFn == ctx.keywordFn) )
+		{
+			model = m;
+			++model->m_refCount;
+			break;
+		}
+	}
+
+	if(!model)
+	{
+		model = new BufferRenderModel;
+		model->m_document = document;
+		model->m_highlightOwner = snapshot.highlightOwner;
+		model->m_width = snapshot.settings.width;
+		model->m_tabSize = ctx.tabSize;
+		model->m_wrapAfter = ctx.wrapAfter;
+		model->m_isCppLikeLanguage = ctx.isCppLikeLanguage;
+		model->m_keywordFn = ctx.keywordFn;
+		s_models.push_back(model);
+	}
+
+	if(g_renderThread)
+		LeaveCriticalSection(&g_renderLock);
+
+	return model;
+}
+
+bool BufferRenderModel::FindIdentifier(const void* document, unsigned __int64 textHash, const wchar_t* word, unsigned int length,
+	bool caseSensitive, std::vector<IdentifierIndex::Span>& spans)
+{
+	// Holding the lock keeps the models from going away; each index has its own lock against updates.
+	if(g_renderThread)
+		EnterCriticalSection(&g_renderLock);
+
+	bool found = false;
+	for(std::vector<BufferRenderModel*>::iterator it = s_models.begin(); !found && (it != s_models.end()); ++it)
+	{
+		if((*it)->m_document == document)
+			found = (*it)->cache.GetIdentifierIndex().Find(textHash, word, length, caseSensitive, spans);
+	}
+
+	if(g_renderThread)
+		LeaveCriticalSection(&g_renderLock);
+
+	return found;
+}
+
+void BufferRenderModel::Release()
+{
+	if(g_renderThread)
+		EnterCriticalSection(&g_renderLock);
+
+	bool last = (--m_refCount == 0);
+	if(last)
+		s_models.erase(std::find(s_models.begin(), s_models.end(), this));
+
+	if(g_renderThread)
+		LeaveCriticalSection(&g_renderLock);
+
+	if(last)
+		delete this;
+}
+
+RenderPipeline::RenderPipeline(HWND notifyWnd, UINT notifyMsg)
+{
+	m_refCount = 1;
+	m_notifyWnd = notifyWnd;
+	m_notifyMsg = notifyMsg;
+	m_queued = false;
+	m_pending = 0;
+	m_pendingHeight = 0;
+	m_trimPending = 0;
+	m_published = 0;
+	m_spare = 0;
+	m_ownBytes = 0;
+	m_modelBytes = 0;
+	m_modelKey = 0;
+	m_model = 0;
+	memset(&m_lastSettings, 0, sizeof(m_lastSettings));
+	m_lastFingerprint = 0;
+	m_canRescale = false;
+	m_textLayerValid = false;
+	m_textLayerGeneration = 0;
+	m_textLayerHeight = 0;
+	m_textLayerWidth = 0;
+	memset(m_textLayerPalette, 0, sizeof(m_textLayerPalette));
+}
+
+RenderPipeline::~RenderPipeline()
+{
+	delete m_pending;
+	delete m_published;
+	delete m_spare;
+	if(m_model)
+		m_model->Release();
+}
+
+void RenderPipeline::AddRef()
+{
+	InterlockedIncrement(&m_refCount);
+}
+
+void RenderPipeline::Release()
+{
+	if(InterlockedDecrement(&m_refCount) == 0)
+		delete this;
+}
+
+void RenderPipeline::Detach()
+{
+	if(g_renderThread)
+		EnterCriticalSection(&g_renderLock);
+	m_notifyWnd = 0;
+	if(g_renderThread)
+		LeaveCriticalSection(&g_renderLock);
+}
+
+void RenderPipeline::Submit(RenderSnapshot* snapshot)
+{
+	// Only the latest snapshot matters, so replace the one which wasn't picked up yet, if any.
+	RenderSnapshot* oldSnapshot = (RenderSnapshot*)InterlockedExchangePointer((PVOID volatile*)&m_pending, snapshot);
+	delete oldSnapshot;
+	// The snapshot has the current height, so it supersedes any rescale which wasn't processed yet. This way, if
+	// the render thread finds both a snapshot and a height, the height is the newer one.
+	InterlockedExchange(&m_pendingHeight, 0);
+	Queue();
+}
+
+void RenderPipeline::Rescale(int barHeight)
+{
+	InterlockedExchange(&m_pendingHeight, barHeight);
+	Queue();
+}
+
+void RenderPipeline::Trim()
+{
+	delete TakeImage();
+	CodeImage* spare = (CodeImage*)InterlockedExchangePointer((PVOID volatile*)&m_spare, 0);
+	delete spare;
+
+	// The rest belongs to the render thread. Stop counting it right away, so the budget doesn't evict the same bar
+	// again before the render thread gets to it.
+	InterlockedExchange(&m_ownBytes, 0);
+	InterlockedExchange(&m_modelBytes, 0);
+	InterlockedExchangePointer((PVOID volatile*)&m_modelKey, 0);
+	InterlockedExchange(&m_trimPending, 1);
+	Queue();
+}
+
+unsigned int RenderPipeline::GetMemoryBytes(const void** modelKey, unsigned int* modelBytes) const
+{
+	// The key is only compared, never dereferenced, so it doesn't matter if the model is gone by now.
+	*modelKey = m_modelKey;
+	*modelBytes = (unsigned int)m_modelBytes;
+	return (unsigned int)m_ownBytes;
+}
+
+void RenderPipeline::Queue()
+{
+	if(!g_renderThread)
+	{
+		Process();
+		return;
+	}
+
+	EnterCriticalSection(&g_renderLock);
+	if(!m_queued)
+	{
+		m_queued = true;
+		AddRef();
+		g_renderQueue.push_back(this);
+	}
+	LeaveCriticalSection(&g_renderLock);
+
+	SetEvent(g_renderEvent);
+}
+
+CodeImage* RenderPipeline::TakeImage()
+{
+	return (CodeImage*)InterlockedExchangePointer((PVOID volatile*)&m_published, 0);
+}
+
+void RenderPipeline::RecycleImage(CodeImage* img)
+{
+	// Keep a single spare; bars only ever alternate between two images.
+	CodeImage* oldSpare = (CodeImage*)InterlockedExchangePointer((PVOID volatile*)&m_spare, img);
+	delete oldSpare;
+}
+
+void RenderPipeline::Process()
+{
+	if(InterlockedExchange(&m_trimPending, 0))
+	{
+		if(m_model)
+			m_model->Release();
+		m_model = 0;
+		std::vector<unsigned int>().swap(m_textLayer);
+		m_textLayerValid = false;
+		m_lineIndex.Release();
+		m_canRescale = false;
+		PublishMemoryBytes(0);
+	}
+
+	RenderSnapshot* snapshot = (RenderSnapshot*)InterlockedExchangePointer((PVOID volatile*)&m_pending, 0);
+	int rescaleHeight = InterlockedExchange(&m_pendingHeight, 0);
+	if(!snapshot && !rescaleHeight)
+		return;
+
+	// Another view of the buffer may have updated the shared cache with its own hidden lines since the last image,
+	// in which case the cache doesn't show what this view does anymore.
+	if( !snapshot && (!m_canRescale || (m_model->fingerprint != m_lastFingerprint)) )
+	{
+		Notify(1);
+		return;
+	}
+
+	CodeImage* img = (CodeImage*)InterlockedExchangePointer((PVOID volatile*)&m_spare, 0);
+	if(!img)
+		img = new CodeImage;
+
+	if(!snapshot)
+	{
+		// Only the bar height changed, so the cached image just needs to be scaled again.
+		BuildImage(*img, m_lastSettings, rescaleHeight);
+	}
+	else
+	{
+		if(rescaleHeight)
+			snapshot->barHeight = rescaleHeight;
+
+		// The fingerprint covers the pinned words themselves rather than their matches, so it has to be taken
+		// before the matches are added to the lines.
+		if(!snapshot->textFingerprint)
+			GetSnapshotFingerprint(*snapshot);
+		if(snapshot->pinnedWords)
+			AddPinnedHighlights(*snapshot);
+
+		int numVirtualLines = CountVirtualLines(*snapshot);
+		if( (snapshot->barHeight > 0) && (numVirtualLines > snapshot->barHeight) &&
+			(numVirtualLines*snapshot->settings.width >= MIN_STREAMED_IMAGE_SIZE) )
+		{
+			// The cached image would be as big as the one we're avoiding, so let go of it. If another view of
+			// the buffer still uses it, it stays around for that one.
+			if(m_model)
+				m_model->Release();
+			m_model = 0;
+			std::vector<unsigned int>().swap(m_textLayer);
+			m_textLayerValid = false;
+			BuildStreamedImage(*img, *snapshot, numVirtualLines);
+			m_canRescale = false;
+		}
+		else
+		{
+			// Acquire before releasing, so the model doesn't go away if it's the same one.
+			BufferRenderModel* model = BufferRenderModel::Acquire(*snapshot, this);
+			if(m_model)
+				m_model->Release();
+			if(model != m_model)
+				m_textLayerValid = false;
+			m_model = model;
+
+			RenderCache& cache = model->cache;
+			if(snapshot->textFingerprint == model->fingerprint)
+			{
+				// Only the markers or the colors have changed, or another view of the buffer has already brought
+				// the cache up to date, so the text doesn't have to be looked at.
+				cache.UpdateLineFlags(snapshot->lines);
+			}
+			else
+			{
+				int firstDirtyLine, endDirtyLine;
+				cache.Update(snapshot->ctx, snapshot->lines, snapshot->settings.width, &firstDirtyLine, &endDirtyLine);
+				if(firstDirtyLine != endDirtyLine)
+					++model->generation;
+				model->fingerprint = snapshot->textFingerprint;
+			}
+			cache.GetIdentifierIndex().SetTextHash(snapshot->textHash);
+
+			BuildImage(*img, snapshot->settings, snapshot->barHeight);
+			m_lastFingerprint = snapshot->textFingerprint;
+			m_canRescale = true;
+		}
+
+		m_lastSettings = snapshot->settings;
+		delete snapshot;
+	}
+
+	PublishMemoryBytes(img);
+
+	// Publish the image. If the UI thread didn't get to the previous one, it can be reused for the next image.
+	CodeImage* oldImg = (CodeImage*)InterlockedExchangePointer((PVOID volatile*)&m_published, img);
+	if(oldImg)
+		RecycleImage(oldImg);
+
+	Notify(0);
+}
+
+void RenderPipeline::Notify(WPARAM needSnapshot)
+{
+	if(g_renderThread)
+		EnterCriticalSection(&g_renderLock);
+	if(m_notifyWnd)
+		PostMessage(m_notifyWnd, m_notifyMsg, needSnapshot, 0);
+	if(g_renderThread)
+		LeaveCriticalSection(&g_renderLock);
+}
+
+void RenderPipeline::PublishMemoryBytes(const CodeImage* img)
+{
+	// Once the bar is done with the image it comes back as the spare, so one image's worth stays with the pipeline.
+	size_t ownBytes = m_textLayer.capacity() * sizeof(unsigned int) + m_lineIndex.GetMemoryBytes();
+	if(img && img->pixels)
+		ownBytes += img->width * img->height * 4;
+
+	InterlockedExchange(&m_ownBytes, (LONG)ownBytes);
+	InterlockedExchange(&m_modelBytes, m_model ? (LONG)m_model->cache.GetMemoryBytes() : 0);
+	InterlockedExchangePointer((PVOID volatile*)&m_modelKey, m_model);
+}
+
+int RenderPipeline::CountVirtualLines(RenderSnapshot& snapshot)
+{
+	// With word wrapping, we'd have to lay out the text to know how many virtual lines there are.
+	if(snapshot.ctx.wrapAfter != INT_MAX)
+		return -1;
+
+	m_lineIndex.Build(snapshot.ctx.text);
+	int numLines = m_lineIndex.GetNumLines();
+
+	if((int)snapshot.lines.size() < numLines)
+	{
+		LineInfo defaultLineInfo = { 0 };
+		snapshot.lines.resize(numLines, defaultLineInfo);
+	}
+
+	// Every visible line is a single virtual line.
+	int numVirtualLines = 0;
+	for(int i = 0; i < numLines; ++i)
+	{
+		if(!(snapshot.lines[i].flags & LineFlag_Hidden))
+			++numVirtualLines;
+	}
+
+	return numVirtualLines;
+}
+
+void RenderPipeline::BuildImage(CodeImage& img, const BarSettings& settings, int barHeight)
+{
+	const RenderCache& cache = m_model->cache;
+	int numLines = cache.GetNumVirtualLines();
+	unsigned int width = settings.width;
+	int height = std::max(0, std::min(numLines, barHeight));
+
+	// The cache only stores color classes, so a color change doesn't require rendering the text again.
+	unsigned int palette[ColorClass_Count];
+	GetPalette(palette, settings);
+
+	if( !m_textLayerValid || (m_model->generation != m_textLayerGeneration) || (height != m_textLayerHeight) ||
+		(width != m_textLayerWidth) || (memcmp(palette, m_textLayerPalette, sizeof(palette)) != 0) )
+		BuildTextLayer(palette, width, height);
+
+	img.numLines = numLines;
+	img.Allocate(width, height);
+	if(!img.pixels)
+		return;
+
+	// The layers don't overlap (the markers replace the pixels under them), so compositing them is a copy of the
+	// text followed by painting the markers.
+	if(height > 0)
+		memcpy(img.pixels, &m_textLayer[0], height * width * sizeof(unsigned int));
+
+	float lineScaleFactor = (numLines <= barHeight) ? 1.0f : 1.0f * barHeight / numLines;
+	PaintMarkedLines(img, cache.GetMarkedLines(), lineScaleFactor, settings);
+}
+
+void RenderPipeline::BuildTextLayer(const unsigned int* palette, unsigned int width, int height)
+{
+	m_textLayerValid = true;
+	m_textLayerGeneration = m_model->generation;
+	m_textLayerHeight = height;
+	m_textLayerWidth = width;
+	memcpy(m_textLayerPalette, palette, sizeof(m_textLayerPalette));
+
+	m_textLayer.resize(height * width);
+	if(height == 0)
+		return;
+
+	const unsigned char* imgBuffer = m_model->cache.GetImage();
+	int numLines = m_model->cache.GetNumVirtualLines();
+	if(numLines == height)
+	{
+		// Expand the palette walking the layer backwards, since it's stored bottom-up like the DIB.
+		const unsigned char* line1 = imgBuffer;
+		unsigned int* line2 = &m_textLayer[0] + (numLines - 1)*width;
+		for(int i = 0; i < numLines; ++i)
+		{
+			g_kernels.expandPalette(line2, line1, width, palette, ColorClass_Count);
+			line1 += width;
+			line2 -= width;
+		}
+	}
+	else
+	{
+		FlipScalePaletteImage(&m_textLayer[0], height, imgBuffer, numLines, width, palette, ColorClass_Count);
+	}
+}
+
+void RenderPipeline::BuildStreamedImage(CodeImage& img, RenderSnapshot& snapshot, int numVirtualLines)
+{
+	const BarSettings& settings = snapshot.settings;
+	unsigned int width = settings.width;
+
+	img.numLines = numVirtualLines;
+	img.Allocate(width, snapshot.barHeight);
+	if(!img.pixels)
+		return;
+
+	unsigned int palette[ColorClass_Count];
+	GetPalette(palette, settings);
+
+	// Each virtual line goes straight into the destination rows it covers.
+	PaletteScaler scaler(img.pixels, img.height, numVirtualLines, width, palette, ColorClass_Count);
+	ScaledBarRenderOp renderOp(scaler, width);
+
+	RenderCache::MarkedLineList markedLines;
+	unsigned int lexerState = LexerState_Code;
+	int virtualLine = 0;
+	int numLines = m_lineIndex.GetNumLines();
+	for(int line = 0; line < numLines; ++line)
+	{
+		int firstVirtualLine = virtualLine;
+		const LineInfo& lineInfo = snapshot.lines[line];
+		RenderLine(renderOp, snapshot.ctx, m_lineIndex.GetLineStart(line), lineInfo, lexerState, virtualLine);
+		if(lineInfo.flags && (virtualLine > firstVirtualLine))
+			markedLines.push_back(std::pair<unsigned int, unsigned int>(firstVirtualLine, lineInfo.flags));
+	}
+
+	PaintMarkedLines(img, markedLines, 1.0f * img.height / numVirtualLines, settings);
+}
+
+unsigned int __stdcall RenderPipeline::ThreadProc(void* /*param*/)
+{
+	while(WaitForSingleObject(g_renderEvent, INFINITE) == WAIT_OBJECT_0)
+	{
+		if(g_stopRenderThread)
+			break;
+
+		for(;;)
+		{
+			EnterCriticalSection(&g_renderLock);
+			if(g_renderQueue.empty())
+			{
+				LeaveCriticalSection(&g_renderLock);
+				break;
+			}
+			RenderPipeline* pipeline = g_renderQueue.front();
+			g_renderQueue.erase(g_renderQueue.begin());
+			// Clear the flag before processing, so that snapshots submitted in the meantime queue it again.
+			pipeline->m_queued = false;
+			LeaveCriticalSection(&g_renderLock);
+
+			pipeline->Process();
+			pipeline->Release();
+		}
+	}
+
+	return 0;
+}
+
+void RenderPipeline::StartThread()
+{
+	if(g_renderThread)
+		return;
+
+	InitializeCriticalSection(&g_renderLock);
+	g_renderEvent = CreateEvent(0, FALSE, FALSE, 0);
+	g_stopRenderThread = 0;
+	g_renderThread = (HANDLE)_beginthreadex(0, 0, ThreadProc, 0, 0, 0);
+	if(!g_renderThread)
+	{
+		Log("MetalScroll: Failed to start the render thread, rendering synchronously.\n");
+		CloseHandle(g_renderEvent);
+		g_renderEvent = 0;
+		DeleteCriticalSection(&g_renderLock);
+		return;
+	}
+
+	SetThreadPriority(g_renderThread, THREAD_PRIORITY_BELOW_NORMAL);
+}
+
+void RenderPipeline::StopThread()
+{
+	if(!g_renderThread)
+		return;
+
+	InterlockedExchange(&g_stopRenderThread, 1);
+	SetEvent(g_renderEvent);
+	WaitForSingleObject(g_renderThread, INFINITE);
+	CloseHandle(g_renderThread);
+	CloseHandle(g_renderEvent);
+	g_renderThread = 0;
+	g_renderEvent = 0;
+
+	for(std::vector<RenderPipeline*>::iterator it = g_renderQueue.begin(); it != g_renderQueue.end(); ++it)
+	{
+		(*it)->m_queued = false;
+		(*it)->Release();
+	}
+	g_renderQueue.clear();
+
+	DeleteCriticalSection(&g_renderLock);
+}
@@ -0,0 +1,256 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+#pragma once
+
+#include "RenderCache.h"
+#include "WordMatcher.h"
+
+// Everything about the look of the bar which affects the code image. It's copied when taking a snapshot, so that
+// the render thread never reads the settings while the options dialog changes them.
+struct BarSettings
+{
+	unsigned int					width;
+	unsigned int					whitespaceColor;
+	unsigned int					upperCaseColor;
+	unsigned int					characterColor;
+	unsigned int					commentColor;
+	unsigned int					matchColor;
+	unsigned int					modifiedLineColor;
+	unsigned int					unsavedLineColor;
+	unsigned int					breakpointColor;
+	unsigned int					bookmarkColor;
+	unsigned int					pinnedColors[MAX_PINNED_WORDS];
+};
+
+// Everything needed to produce the code image of a view, copied on the UI thread so that the render thread never
+// touches the editor or the settings. The line list points into the highlight storage, so snapshots aren't copyable.
+struct RenderSnapshot
+{
+	RenderSnapshot() : document(0), highlightOwner(0), barHeight(0), textFingerprint(0), textHash(0), pinnedWords(0) {}
+	~RenderSnapshot() { if(pinnedWords) pinnedWords->Release(); }
+
+	// Identifies the text buffer, so that views of the same buffer can share a render cache. Only compared, never
+	// dereferenced; 0 if the text doesn't come from a buffer.
+	const void*						document;
+	// Identifies the match store the highlights come from, 0 if they come from the editor markers. Only compared,
+	// like the document. The views of a buffer share its match store, but a view which reads the markers only sees
+	// the ones around the visible lines, and the highlights are part of the rendered rows, so it needs a cache of
+	// its own.
+	const void*						highlightOwner;
+
+	CComBSTR						text;
+	RenderContext					ctx;
+	LineList						lines;
+	HighlightList					highlights;
+	BarSettings						settings;
+	int								barHeight;
+	// Set by GetSnapshotFingerprint(), 0 if it wasn't called. The text hash only covers the characters.
+	unsigned __int64				textFingerprint;
+	unsigned __int64				textHash;
+
+	// The pinned words, with a reference held by the snapshot, or 0 if there are none. They're matched on the
+	// render thread, which adds the matches to the line list, with their storage in pinnedHighlights.
+	WordMatcher*					pinnedWords;
+	HighlightList					pinnedHighlights;
+};
+
+// A hash of everything in the snapshot which affects the finished image, except for the bar height. Snapshots with
+// the same fingerprint only need rendering if the height changed, and then only need rescaling. Also stores the
+// hash of the part the rendered text depends on (everything except the line markers and the colors) in the
+// snapshot, so the render thread can tell when only the layers painted over the text have changed.
+unsigned __int64 GetSnapshotFingerprint(RenderSnapshot& snapshot);
+
+// Fills in the text part of a snapshot (text, context, line info); the settings and the bar height are up to the caller.
+struct TextSource
+{
+	virtual bool GetSnapshot(RenderSnapshot& snapshot) = 0;
+};
+
+class ViewTextSource : public TextSource
+{
+public:
+	// The highlights come from the match store if it's not 0, see GetLineInfo().
+	ViewTextSource(IVsTextView* view, const MatchStore* matches) : m_view(view), m_matches(matches) {}
+	bool							GetSnapshot(RenderSnapshot& snapshot);
+
+private:
+	IVsTextView*					m_view;
+	const MatchStore*				m_matches;
+};
+
+// Takes the text from a string instead of an editor view, with no line markers. Useful for driving the pipeline
+// without a running IDE.
+class StringTextSource : public TextSource
+{
+public:
+	StringTextSource(const wchar_t* text, IsKeywordFnPtr keywordFn, int tabSize) : m_text(text), m_keywordFn(keywordFn), m_tabSize(tabSize) {}
+	bool							GetSnapshot(RenderSnapshot& snapshot);
+
+private:
+	const wchar_t*					m_text;
+	IsKeywordFnPtr					m_keywordFn;
+	int								m_tabSize;
+};
+
+// A finished code image, scaled to the bar height and with the line markers painted over it. The pixels live in a
+// DIB section which the bar blits from directly, so rows are stored bottom-up.
+struct CodeImage
+{
+	CodeImage();
+	~CodeImage();
+
+	// Makes the DIB section the given size. The current one is kept if it already has that size, in which case
+	// the pixels still hold the previous image.
+	void							Allocate(unsigned int width, int height);
+
+	HBITMAP							bitmap;
+	unsigned int*					pixels;
+	unsigned int					width;
+	int								height;
+	int								numLines;
+
+private:
+	CodeImage(const CodeImage&);
+	CodeImage&						operator=(const CodeImage&);
+};
+
+// The render cache of a text buffer, shared by the pipelines of all the views showing it with the same render
+// settings, so that a split window doesn't lex the same text twice. Each pipeline still scales its own image. Only
+// the render thread touches the cache; acquiring and releasing a model is safe from any thread.
+class BufferRenderModel
+{
+public:
+	// Returns the model for the snapshot's buffer, highlight owner and settings, creating it if needed, with a
+	// reference added. Snapshots without a buffer use the owner as the key, so they never share a model.
+	static BufferRenderModel*		Acquire(const RenderSnapshot& snapshot, const void* owner);
+	void							Release();
+	// Looks up an identifier in the index of any model of the document which was last updated with the text that
+	// has the given hash. Returns false if there's no such model; see IdentifierIndex::Find().
+	static bool						FindIdentifier(const void* document, unsigned __int64 textHash, const wchar_t* word, unsigned int length,
+										bool caseSensitive, std::vector<IdentifierIndex::Span>& spans);
+
+	RenderCache						cache;
+	// The text fingerprint of the snapshot the cache was last updated with.
+	unsigned __int64				fingerprint;
+	// Incremented whenever the rendered rows change, so pipelines know when to scale the image again.
+	unsigned int					generation;
+
+private:
+	BufferRenderModel() : fingerprint(0), generation(0), m_refCount(1) {}
+
+	const void*						m_document;
+	const void*						m_highlightOwner;
+	unsigned int					m_width;
+	int								m_tabSize;
+	int								m_wrapAfter;
+	bool							m_isCppLikeLanguage;
+	IsKeywordFnPtr					m_keywordFn;
+	int								m_refCount;
+
+	static std::vector<BufferRenderModel*>	s_models;
+};
+
+// Renders the code image of a bar on the render thread. The UI thread submits snapshots and picks up finished
+// images; if a new snapshot arrives before the previous one was processed, the old one is dropped. When an image
+// is ready, the notification message is posted to the window with a wparam of 0. Pipelines are reference counted
+// since the render thread may still be holding one after its bar was destroyed.
+class RenderPipeline
+{
+public:
+	RenderPipeline(HWND notifyWnd, UINT notifyMsg);
+
+	void							AddRef();
+	void							Release();
+
+	// Stops posting notifications. Must be called before the window is destroyed.
+	void							Detach();
+
+	// Takes ownership of the snapshot.
+	void							Submit(RenderSnapshot* snapshot);
+	// Scales the last image to a new bar height without going through the text again. If the full resolution image
+	// isn't around anymore, nothing is rendered and the notification is posted with a wparam of 1, meaning that a
+	// new snapshot is needed.
+	void							Rescale(int barHeight);
+	// Returns the latest finished image, or 0 if there isn't a new one. The caller owns the returned image.
+	CodeImage*						TakeImage();
+	// Hands back an image the caller doesn't need anymore, so its DIB section can be reused for the next one. The
+	// bitmap must not be selected into a DC.
+	void							RecycleImage(CodeImage* img);
+	// Frees everything kept between images: the finished and spare images, the text layer and the reference to the
+	// shared cache. The next snapshot is rendered from scratch, unless another view keeps the cache alive.
+	void							Trim();
+	// Returns the memory the render thread holds for this pipeline: the text layer, the line index and the image in
+	// flight. The shared model is reported separately, along with its address, so that views sharing it can count
+	// it once. The figures are published after each image, so they may be a little behind.
+	unsigned int					GetMemoryBytes(const void** modelKey, unsigned int* modelBytes) const;
+
+	// Without a render thread, snapshots are processed synchronously inside Submit().
+	static void						StartThread();
+	static void						StopThread();
+
+private:
+	~RenderPipeline();
+
+	volatile LONG					m_refCount;
+	HWND							m_notifyWnd;
+	UINT							m_notifyMsg;
+	bool							m_queued;
+
+	RenderSnapshot* volatile		m_pending;
+	volatile LONG					m_pendingHeight;
+	volatile LONG					m_trimPending;
+	CodeImage* volatile				m_published;
+	CodeImage* volatile				m_spare;
+
+	// Published by the render thread for GetMemoryBytes().
+	volatile LONG					m_ownBytes;
+	volatile LONG					m_modelBytes;
+	void* volatile					m_modelKey;
+
+	// Only touched by the render thread. The settings and the text fingerprint are remembered for rescaling, which
+	// is only possible when the last image was built from the shared cache and no other view has changed it since.
+	BufferRenderModel*				m_model;
+	BarSettings						m_lastSettings;
+	unsigned __int64				m_lastFingerprint;
+	bool							m_canRescale;
+
+	// The text layer is the scaled text without the markers, kept so that marker changes only need it copied into
+	// the finished image. It's valid for the model generation, height, width and palette it was built with.
+	std::vector<unsigned int>		m_textLayer;
+	bool							m_textLayerValid;
+	unsigned int					m_textLayerGeneration;
+	int								m_textLayerHeight;
+	unsigned int					m_textLayerWidth;
+	unsigned int					m_textLayerPalette[ColorClass_Count];
+
+	// The lines of the last snapshot, used to count its virtual lines and to stream it when it's too big to cache.
+	LineIndex						m_lineIndex;
+
+	void							Queue();
+	void							Process();
+	void							Notify(WPARAM needSnapshot);
+	void							PublishMemoryBytes(const CodeImage* img);
+	void							BuildImage(CodeImage& img, const BarSettings& settings, int barHeight);
+	void							BuildTextLayer(const unsigned int* palette, unsigned int width, int height);
+	void							BuildStreamedImage(CodeImage& img, RenderSnapshot& snapshot, int numVirtualLines);
+
+	// Returns the number of virtual lines the snapshot renders to, or -1 if it can't be known without rendering.
+	// Adds default entries for the lines found in the text beyond the end of the line list.
+	int								CountVirtualLines(RenderSnapshot& snapshot);
+
+	static unsigned int __stdcall	ThreadProc(void* param);
+};
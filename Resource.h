@@ -27,6 +27,9 @@
 #define IDC_PREVIEW_FG                  218
 #define IDC_CASE_SENSITIVE              219
 #define IDC_WHOLE_WORD_ONLY             220
+#define IDC_PINNED_WORD1                221
+#define IDC_PINNED_WORD2                222
+#define IDC_PINNED_WORD3                223
 
 // Next default values for new objects
 // 
@@ -34,7 +37,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        202
 #define _APS_NEXT_COMMAND_VALUE         32768
-#define _APS_NEXT_CONTROL_VALUE         215
+#define _APS_NEXT_CONTROL_VALUE         224
 #define _APS_NEXT_SYMED_VALUE           106
 #endif
 #endif
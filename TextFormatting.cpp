@@ -17,6 +17,9 @@
 #include "MetalScrollPCH.h"
 #include "TextFormatting.h"
 #include "CppLexer.h"
+#include "RenderCore.h"
+#include "Utils.h"
+#include "MatchStore.h"
 
 extern CComPtr<EnvDTE80::DTE2>		g_dte;
 extern long							g_highlightMarkerType;
@@ -31,22 +34,6 @@ static const GUID					g_csharpLangGUID	= { 0x694DD9B6, 0xB865, 0x4C5B, { 0xAD, 0
 static const GUID					g_uscriptGUID		= { 0x21feefb5, 0xace1, 0x4461, { 0xba, 0x7c, 0x6f, 0x66, 0x45, 0x74, 0x45, 0xfd } };
 
 
-struct Highlight
-{
-	unsigned int				start;
-	unsigned int				end;
-	Highlight*					next;
-};
-
-struct LineInfo
-{
-	unsigned int				flags;
-	Highlight*					highlights;
-};
-
-typedef std::vector<LineInfo>	LineList;
-typedef std::vector<Highlight>	HighlightList;
-
 void ProcessLineMarkers(IVsTextLines* buffer, int type, const MarkerOperator& op)
 {
 	long numLines;
@@ -240,6 +227,7 @@ static void GetHighlights(LineList& lines, IVsTextLines* buffer, HighlightList&
 			Highlight* newh = &storage[idx];
 			newh->start = span.iStartIndex;
 			newh->end = span.iEndIndex;
+			newh->slot = 0;
 
 			// Add a marker on the right to make it easier to see.
 			if(!line.highlights)
@@ -273,230 +261,81 @@ static void GetHighlights(LineList& lines, IVsTextLines* buffer, HighlightList&
 	ProcessLineMarkers(buffer, g_highlightMarkerType, AddHighlightOp(lines, storage));
 }
 
-typedef bool(*IsKeywordFnPtr)(const wchar_t* c, unsigned int l);
-bool IsUscriptKeyword(const wchar_t* c, unsigned int l);
-
-int RenderText(RenderOperator& renderOp, IVsTextView* view, IVsTextLines* buffer, const wchar_t* text, int numLines)
+bool GetViewText(IVsTextView* view, IVsTextLines** buffer, BSTR* text, long* numLines)
 {
-	LANGPREFERENCES langPrefs;
-	int wrapAfter = INT_MAX;
-	int tabSize = 4;
-	
-	bool isCppLikeLanguage = false;
-	bool isUScript = false;
+	HRESULT hr = view->GetBuffer(buffer);
+	if(FAILED(hr) || !*buffer)
+	{
+		static bool warningShown = false;
+		if(!warningShown)
+		{
+			Log("MetalScroll: Failed to get buffer for view 0x%p.", view);
+			warningShown = true;
+		}
+		return false;
+	}
+
+	hr = (*buffer)->GetLineCount(numLines);
+	if(FAILED(hr))
+		return false;
 
-	IsKeywordFnPtr keywordFn = 0;
+	long numCharsLastLine;
+	hr = (*buffer)->GetLengthOfLine(*numLines - 1, &numCharsLastLine);
+	if(FAILED(hr))
+		return false;
+
+	hr = (*buffer)->GetLineText(0, 0, *numLines - 1, numCharsLastLine, text);
+	return SUCCEEDED(hr) && (*text);
+}
 
+void GetRenderContext(RenderContext& ctx, IVsTextView* view, IVsTextLines* buffer, const wchar_t* text)
+{
+	ctx.text = text;
+	ctx.wrapAfter = INT_MAX;
+	ctx.tabSize = 4;
+	ctx.isCppLikeLanguage = false;
+	ctx.keywordFn = 0;
+
+	LANGPREFERENCES langPrefs;
 	if( SUCCEEDED(buffer->GetLanguageServiceID(&langPrefs.guidLang)) && SUCCEEDED(g_textMgr->GetUserPreferences(0, 0, &langPrefs, 0)) )
 	{
-		tabSize = langPrefs.uTabSize;
-		isUScript = InlineIsEqualGUID(langPrefs.guidLang, g_uscriptGUID) ? true : false;
-		isCppLikeLanguage = InlineIsEqualGUID(langPrefs.guidLang, g_cppLangGUID) || 
-							InlineIsEqualGUID(langPrefs.guidLang, g_csharpLangGUID) ||
-							isUScript;
+		ctx.tabSize = langPrefs.uTabSize;
+		bool isUScript = InlineIsEqualGUID(langPrefs.guidLang, g_uscriptGUID) ? true : false;
+		ctx.isCppLikeLanguage = InlineIsEqualGUID(langPrefs.guidLang, g_cppLangGUID) || 
+								InlineIsEqualGUID(langPrefs.guidLang, g_csharpLangGUID) ||
+								isUScript;
 		if(isUScript)
-			keywordFn = IsUscriptKeyword;
-		else if(isCppLikeLanguage)
-			keywordFn = IsCppKeyword;
+			ctx.keywordFn = IsUscriptKeyword;
+		else if(ctx.isCppLikeLanguage)
+			ctx.keywordFn = IsCppKeyword;
 
 		if(langPrefs.fWordWrap)
 		{
 			long min, max, pageWidth, pos;
 			if(SUCCEEDED(view->GetScrollInfo(SB_HORZ, &min, &max, &pageWidth, &pos)) && (pageWidth > 1))
-				wrapAfter = pageWidth - 1;
+				ctx.wrapAfter = pageWidth - 1;
 		}
 	}
+}
 
-	if(numLines < 1)
-		numLines = 1;
-
+void GetLineInfo(LineList& lines, HighlightList& highlightStorage, IVsTextLines* buffer, int numLines, const MatchStore* matches)
+{
 	LineInfo defaultLineInfo = { 0 };
-	LineList lines(numLines, defaultLineInfo);
+	lines.assign(numLines, defaultLineInfo);
 	GetLineFlags(lines, buffer);
-	HighlightList highlightStorage;
-	GetHighlights(lines, buffer, highlightStorage);
-
-	renderOp.Init(numLines);
-
-	enum CommentType
-	{
-		CommentType_None,
-		CommentType_SingleLine,
-		CommentType_MultiLine
-	} commentType = CommentType_None;
-	bool inKeyword = false;
-	bool inString = false;
-
-	// Here "virtual" refers to rendered coordinates, which can differ from real text coordinates due to word wrapping,
-	// hidden text regions and tabs.
-	int virtualLine = 0;
-	int virtualColumn = 0;
-	int realLine = 0;
-	int realColumn = 0;
-	Highlight* crHighlight = lines[0].highlights;
-
-	for(const wchar_t* chr = text; ; ++chr)
-	{
-		// Check for a real newline, a virtual newline (due to word wrapping) or the end of the text.
-		bool isRealNewline = (chr[0] == L'\r') || (chr[0] == L'\n');
-		bool isVirtualNewline = (virtualColumn >= wrapAfter);
-		bool isTextEnd = (chr[0] == 0);
-		bool isLineVisible = !(lines[realLine].flags & LineFlag_Hidden);
-		if(isRealNewline || isVirtualNewline || isTextEnd)
-		{
-			if(isLineVisible)
-			{
-				if(isVirtualNewline && !isRealNewline)
-				{
-					CharClass crChrClass = GetCharClass(*chr);
-					if(crChrClass != CharClass_Other)
-					{
-						// Go back looking for the beginning of the current "word", i.e. for the first character which doesn't
-						// match the class of the current character, or the (virtual) start of the line.
-						int currentWordLen = 1;
-						for(; currentWordLen <= virtualColumn; ++currentWordLen)
-						{
-							if(GetCharClass(chr[-currentWordLen]) != crChrClass)
-							{
-								--currentWordLen;
-								break;
-							}
-						}
-
-						// VS moves the entire word on the next line unless it starts on the 1st or 2nd column.
-						if(virtualColumn - currentWordLen > 1)
-						{
-							// Rewind the text so we can draw the entire wrapped word on the next line.
-							chr -= currentWordLen;
-							realColumn -= currentWordLen;
-							// Move back the virtual column so that the end of line handler can erase the
-							// part of the word we've already painted.
-							virtualColumn -= currentWordLen;
-						}
-					}
-				}
-
-				renderOp.EndLine(virtualLine, virtualColumn, lines[realLine].flags, isTextEnd);
-
-				// Advance the virtual line.
-				virtualColumn = 0;
-				++virtualLine;
-			}
-
-			if(isTextEnd)
-				break;
-
-			if(isRealNewline)
-			{
-				++realLine;
-				realColumn = 0;
-				inKeyword = false;
-				inString = false;
-
-				// In case of CRLF, eat the next character too.
-				if( (chr[0] == L'\r') && (chr[1] == L'\n') )
-					++chr;
-
-				crHighlight = lines[realLine].highlights;
-
-				if(commentType == CommentType_SingleLine)
-					commentType = CommentType_None;
-				continue;
-			}
-
-			// If it's a virtual newline, we keep processing the current character.
-		}
-
-		int numChars = 1;
-		if(*chr > L' ')
-		{
-			unsigned int textFlags = 0;
-
-			switch(commentType)
-			{
-				case CommentType_None:
-					if(!isCppLikeLanguage)
-						break;
-
-					if( !inString && (chr[0] == L'/') && (chr[1] == L'/') )
-					{
-						textFlags |= TextFlag_Comment;
-						commentType = CommentType_SingleLine;
-						inKeyword = false;
-					}
-					else if( !inString && (chr[0] == L'/') && (chr[1] == L'*') )
-					{
-						textFlags |= TextFlag_Comment;
-						commentType = CommentType_MultiLine;
-						inKeyword = false;
-					}
-					else if(chr[0] == L'"')
-					{
-						inKeyword = false;
-						if(inString)
-						{
-							const wchar_t* backslashStart = chr - 1;
-							while( (backslashStart >= text) && (*backslashStart == L'\\') )
-								--backslashStart;
-							int numBackslashes = int(chr - backslashStart - 1);
-							if(numBackslashes % 2 == 0)
-								inString = false;
-						}
-						else
-							inString = true;
-					}
-					else if(!inKeyword && !inString && IsCppIdStart(chr[0]) && ((chr == text) || IsCppIdSeparator(chr[-1])) )
-					{
-						const wchar_t* keywordEnd = chr + 1;
-						while(!IsCppIdSeparator(*keywordEnd))
-							++keywordEnd;
-						int len = int(keywordEnd - chr);
-						inKeyword = keywordFn(chr, len);
-					}
-					else if(inKeyword && IsCppIdSeparator(chr[0]))
-						inKeyword = false;
-					break;
-
-				case CommentType_SingleLine:
-					textFlags |= TextFlag_Comment;
-					break;
-
-				case CommentType_MultiLine:
-					textFlags |= TextFlag_Comment;
-					if( (chr[-1] == L'*') && (chr[0] == L'/') )
-						commentType = CommentType_None;
-					break;
-			}
-
-			if(inKeyword)
-				textFlags |= TextFlag_Keyword;
-
-			// Advance the highlight interval, if needed.
-			while(crHighlight && (realColumn >= (int)crHighlight->end))
-				crHighlight = crHighlight->next;
-
-			// Override the color with the match color if inside a marker.
-			if(crHighlight && (realColumn >= (int)crHighlight->start))
-				textFlags |= TextFlag_Highlight;
-
-			if(isLineVisible)
-				renderOp.RenderCharacter(virtualLine, virtualColumn, *chr, textFlags);
-		}
-		else
-		{
-			inKeyword = false;
-
-			if(*chr == L'\t')
-				numChars = tabSize - (virtualColumn % tabSize);
-
-			if(isLineVisible)
-				renderOp.RenderSpaces(virtualLine, virtualColumn, numChars);
-		}
+	if(matches)
+		matches->GetHighlights(lines, highlightStorage);
+	else
+		GetHighlights(lines, buffer, highlightStorage);
+}
 
-		++realColumn;
-		virtualColumn += numChars;
-	}
+const wchar_t* RenderLine(RenderOperator& renderOp, const RenderContext& ctx, const wchar_t* lineStart, const LineInfo& line, unsigned int& lexerState, int& virtualLine)
+{
+	// The generic path: virtual calls to the operator and the language taken from the context.
+	return RenderLineSpecialized<RuntimeLanguage>(renderOp, ctx, lineStart, line, lexerState, virtualLine);
+}
 
-	assert(realLine == numLines - 1);
-	return virtualLine;
+int RenderText(RenderOperator& renderOp, IVsTextView* view, IVsTextLines* buffer, const wchar_t* text, int numLines, const MatchStore* matches)
+{
+	return RenderText<RenderOperator>(renderOp, view, buffer, text, numLines, matches);
 }
@@ -16,6 +16,8 @@
 
 #pragma once
 
+class MatchStore;
+
 struct MarkerOperator
 {
 	virtual void NotifyCount(int /*numMarkers*/) const {}
@@ -24,6 +26,9 @@ struct MarkerOperator
 
 void ProcessLineMarkers(IVsTextLines* buffer, int type, const MarkerOperator& op);
 
+// How many words can be pinned at once, each with its own highlight color.
+#define MAX_PINNED_WORDS			3
+
 enum LineFlags
 {
 	LineFlag_Hidden				= 0x01,
@@ -31,22 +36,88 @@ enum LineFlags
 	LineFlag_ChangedSaved		= 0x04,
 	LineFlag_Breakpoint			= 0x08,
 	LineFlag_Bookmark			= 0x10,
-	LineFlag_Match				= 0x20
+	LineFlag_Match				= 0x20,
+	// Lines with matches of pinned word i have LineFlag_Pinned << i set.
+	LineFlag_Pinned				= 0x40
 };
 
 enum TextFlags
 {
 	TextFlag_Comment			= 0x01,
 	TextFlag_Highlight			= 0x02,
-	TextFlag_Keyword			= 0x04
+	TextFlag_Keyword			= 0x04,
+	// Highlighted text has the slot of its highlight from this bit up.
+	TextFlag_SlotShift			= 3
+};
+
+// The state of the lexer at the start of a line. Strings and single line comments end with the line, so
+// the only thing which carries over from one line to the next is being inside a multi-line comment.
+enum LexerState
+{
+	LexerState_Code				= 0,
+	LexerState_MultiLineComment	= 1
+};
+
+struct Highlight
+{
+	unsigned int				start;
+	unsigned int				end;
+	// 0 for the word highlighted with the editor markers, i + 1 for pinned word i.
+	unsigned int				slot;
+	Highlight*					next;
+};
+
+struct LineInfo
+{
+	unsigned int				flags;
+	Highlight*					highlights;
+};
+
+typedef std::vector<LineInfo>	LineList;
+typedef std::vector<Highlight>	HighlightList;
+
+typedef bool(*IsKeywordFnPtr)(const wchar_t* c, unsigned int l);
+
+struct RenderContext
+{
+	const wchar_t*				text;
+	int							tabSize;
+	int							wrapAfter;
+	bool						isCppLikeLanguage;
+	IsKeywordFnPtr				keywordFn;
 };
 
 struct RenderOperator
 {
 	virtual void Init(int numLines) = 0;
 	virtual void EndLine(int line, int lastColumn, unsigned int lineFlags, bool textEnd) = 0;
+	// Consecutive whitespace on a line, tabs already expanded.
 	virtual void RenderSpaces(int line, int column, int count) = 0;
+	// A run of consecutive non-whitespace characters on a line, all with the same text flags. Character i
+	// goes to column + i.
+	virtual void RenderRun(int line, int column, const wchar_t* chars, int count, unsigned int flags) = 0;
+};
+
+// Adapter for operators which paint one character at a time.
+struct CharRenderOperator : public RenderOperator
+{
 	virtual void RenderCharacter(int line, int column, wchar_t chr, unsigned int flags) = 0;
+
+	void RenderRun(int line, int column, const wchar_t* chars, int count, unsigned int flags)
+	{
+		for(int i = 0; i < count; ++i)
+			RenderCharacter(line, column + i, chars[i], flags);
+	}
 };
 
-int RenderText(RenderOperator& renderOp, IVsTextView* view, IVsTextLines* buffer, const wchar_t* text, int numLines);
+bool GetViewText(IVsTextView* view, IVsTextLines** buffer, BSTR* text, long* numLines);
+void GetRenderContext(RenderContext& ctx, IVsTextView* view, IVsTextLines* buffer, const wchar_t* text);
+// The highlights come from the match store if there is one, otherwise from the highlight markers in the buffer.
+void GetLineInfo(LineList& lines, HighlightList& highlightStorage, IVsTextLines* buffer, int numLines, const MatchStore* matches);
+
+// Renders a single real line, which can produce zero (hidden) or more (word wrapped) virtual lines. The
+// lexer state is updated to the state at the start of the next line. Returns the start of the next line,
+// or 0 if this was the last line in the text.
+const wchar_t* RenderLine(RenderOperator& renderOp, const RenderContext& ctx, const wchar_t* lineStart, const LineInfo& line, unsigned int& lexerState, int& virtualLine);
+
+int RenderText(RenderOperator& renderOp, IVsTextView* view, IVsTextLines* buffer, const wchar_t* text, int numLines, const MatchStore* matches);
@@ -0,0 +1,397 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+
+#include "MetalScrollPCH.h"
+#include "TextSearch.h"
+#include "CppLexer.h"
+
+// Lower case for ASCII letters, which is all _wcsnicmp() folds for characters below 0x80, whatever the locale.
+static inline wchar_t FoldAscii(wchar_t chr)
+{
+	return ((unsigned int)(chr - L'A') <= L'Z' - L'A') ? (wchar_t)(chr | 0x20) : chr;
+}
+
+SearchPattern::SearchPattern(const wchar_t* word_, unsigned int length_, bool wholeWord_) : word(word_), length(length_), wholeWord(wholeWord_)
+{
+	folded.assign(word, word + length);
+	for(unsigned int i = 0; i < length; ++i)
+	{
+		if(folded[i] >= 0x80)
+		{
+			folded.clear();
+			break;
+		}
+
+		folded[i] = FoldAscii(folded[i]);
+	}
+}
+
+static inline bool IsWholeWord(const SearchPattern& pattern, const wchar_t* text, const wchar_t* chr)
+{
+	return ((chr == text) || IsCppIdSeparator(chr[-1])) && IsCppIdSeparator(chr[pattern.length]);
+}
+
+static inline bool MatchesAt(const SearchPattern& pattern, const wchar_t* text, const wchar_t* chr)
+{
+	return (wcsncmp(chr, pattern.word, pattern.length) == 0) && (!pattern.wholeWord || IsWholeWord(pattern, text, chr));
+}
+
+const wchar_t* FindTextPlainC(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end)
+{
+	for(const wchar_t* chr = start; chr < end; ++chr)
+	{
+		if(MatchesAt(pattern, text, chr))
+			return chr;
+	}
+
+	return 0;
+}
+
+// The vector kernels compare the first and the last character of the word at a block of positions at once, and
+// only compare the rest of the word at the positions where both match. For whole word searches, positions preceded
+// or followed by an identifier character are thrown out in the same pass. The loads must stay inside the range or
+// just past its end (which is part of the text, since the text is null-terminated), so close to the end of the
+// range only the first character is compared in blocks, and the last few positions are checked one at a time.
+
+// Returns all ones in the lanes which hold [0-9A-Za-z_], i.e. the characters IsCppIdSeparator() returns false for.
+// (c - lo) <= (hi - lo) as unsigned 16-bit values is a range check, and a saturating subtract of (hi - lo) tells
+// whether it holds. Setting bit 5 turns upper case letters into lower case ones without letting anything else in.
+static inline __m128i IsIdCharSSE2(__m128i chars)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i digit = _mm_subs_epu16(_mm_sub_epi16(chars, _mm_set1_epi16(L'0')), _mm_set1_epi16(9));
+	__m128i lower = _mm_or_si128(chars, _mm_set1_epi16(0x20));
+	__m128i letter = _mm_subs_epu16(_mm_sub_epi16(lower, _mm_set1_epi16(L'a')), _mm_set1_epi16(25));
+	__m128i isId = _mm_or_si128(_mm_cmpeq_epi16(digit, zero), _mm_cmpeq_epi16(letter, zero));
+	return _mm_or_si128(isId, _mm_cmpeq_epi16(chars, _mm_set1_epi16(L'_')));
+}
+
+static inline const wchar_t* VerifyCandidates(const SearchPattern& pattern, const wchar_t* chr, unsigned int mask)
+{
+	// Two mask bits per character. The first and the last character are known to match.
+	unsigned int middleSize = (pattern.length > 2) ? (pattern.length - 2) * sizeof(wchar_t) : 0;
+	while(mask)
+	{
+		unsigned long bit;
+		_BitScanForward(&bit, mask);
+		const wchar_t* candidate = chr + bit / 2;
+		if(memcmp(candidate + 1, pattern.word + 1, middleSize) == 0)
+			return candidate;
+		mask &= ~(3u << bit);
+	}
+
+	return 0;
+}
+
+const wchar_t* FindTextSSE2(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end)
+{
+	unsigned int length = pattern.length;
+	const wchar_t* chr = start;
+	if(pattern.wholeWord && (chr == text) && (chr < end))
+	{
+		// There's nothing before the first character to load.
+		if(MatchesAt(pattern, text, chr))
+			return chr;
+		++chr;
+	}
+
+	__m128i first = _mm_set1_epi16(pattern.word[0]);
+	__m128i last = _mm_set1_epi16(pattern.word[length - 1]);
+	for(; chr + 8 + length <= end; chr += 8)
+	{
+		__m128i hits = _mm_and_si128(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)chr), first),
+			_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(chr + length - 1)), last));
+		if(pattern.wholeWord)
+		{
+			hits = _mm_andnot_si128(IsIdCharSSE2(_mm_loadu_si128((const __m128i*)(chr - 1))), hits);
+			hits = _mm_andnot_si128(IsIdCharSSE2(_mm_loadu_si128((const __m128i*)(chr + length))), hits);
+		}
+
+		unsigned int mask = _mm_movemask_epi8(hits);
+		if(mask)
+		{
+			const wchar_t* match = VerifyCandidates(pattern, chr, mask);
+			if(match)
+				return match;
+		}
+	}
+
+	for(; chr + 8 <= end; chr += 8)
+	{
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)chr), first));
+		while(mask)
+		{
+			unsigned long bit;
+			_BitScanForward(&bit, mask);
+			const wchar_t* candidate = chr + bit / 2;
+			if(MatchesAt(pattern, text, candidate))
+				return candidate;
+			mask &= ~(3u << bit);
+		}
+	}
+
+	for(; chr < end; ++chr)
+	{
+		if( (*chr == pattern.word[0]) && MatchesAt(pattern, text, chr) )
+			return chr;
+	}
+
+	return 0;
+}
+
+#if _MSC_VER >= 1700
+
+static inline __m256i IsIdCharAVX2(__m256i chars)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i digit = _mm256_subs_epu16(_mm256_sub_epi16(chars, _mm256_set1_epi16(L'0')), _mm256_set1_epi16(9));
+	__m256i lower = _mm256_or_si256(chars, _mm256_set1_epi16(0x20));
+	__m256i letter = _mm256_subs_epu16(_mm256_sub_epi16(lower, _mm256_set1_epi16(L'a')), _mm256_set1_epi16(25));
+	__m256i isId = _mm256_or_si256(_mm256_cmpeq_epi16(digit, zero), _mm256_cmpeq_epi16(letter, zero));
+	return _mm256_or_si256(isId, _mm256_cmpeq_epi16(chars, _mm256_set1_epi16(L'_')));
+}
+
+const wchar_t* FindTextAVX2(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end)
+{
+	unsigned int length = pattern.length;
+	const wchar_t* chr = start;
+	if(pattern.wholeWord && (chr == text) && (chr < end))
+	{
+		if(MatchesAt(pattern, text, chr))
+			return chr;
+		++chr;
+	}
+
+	__m256i first = _mm256_set1_epi16(pattern.word[0]);
+	__m256i last = _mm256_set1_epi16(pattern.word[length - 1]);
+	for(; chr + 16 + length <= end; chr += 16)
+	{
+		__m256i hits = _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)chr), first),
+			_mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(chr + length - 1)), last));
+		if(pattern.wholeWord)
+		{
+			hits = _mm256_andnot_si256(IsIdCharAVX2(_mm256_loadu_si256((const __m256i*)(chr - 1))), hits);
+			hits = _mm256_andnot_si256(IsIdCharAVX2(_mm256_loadu_si256((const __m256i*)(chr + length))), hits);
+		}
+
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(hits);
+		if(mask)
+		{
+			const wchar_t* match = VerifyCandidates(pattern, chr, mask);
+			if(match)
+				return match;
+		}
+	}
+
+	// Finish with the SSE2 loops, which can still cover blocks too close to the end for this one.
+	return FindTextSSE2(pattern, text, chr, end);
+}
+
+#endif
+
+const wchar_t* FindTextNoCasePlainC(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end)
+{
+	for(const wchar_t* chr = start; chr < end; ++chr)
+	{
+		if( (_wcsnicmp(chr, pattern.word, pattern.length) == 0) && (!pattern.wholeWord || IsWholeWord(pattern, text, chr)) )
+			return chr;
+	}
+
+	return 0;
+}
+
+// Compare the word to the text at chr using the folded word. The word is all ASCII, but the text past the end of the
+// range may not be, and from the first character outside ASCII on _wcsnicmp() decides.
+static inline bool MatchesAtNoCase(const SearchPattern& pattern, const wchar_t* text, const wchar_t* chr)
+{
+	const wchar_t* folded = &pattern.folded[0];
+	for(unsigned int i = 0; i < pattern.length; ++i)
+	{
+		wchar_t c = chr[i];
+		if(c >= 0x80)
+		{
+			if(_wcsnicmp(chr + i, pattern.word + i, pattern.length - i) != 0)
+				return false;
+			break;
+		}
+
+		if(FoldAscii(c) != folded[i])
+			return false;
+	}
+
+	return !pattern.wholeWord || IsWholeWord(pattern, text, chr);
+}
+
+// The case insensitive kernels fold the text in the vector lanes the same way FoldAscii() does. That's only exact for
+// ASCII, so ranges with other characters go to the plain C loop. Since the loads of the last character stay inside
+// the range, the filter never sees the text past its end; MatchesAtNoCase() checks that part.
+
+static inline __m128i FoldAsciiSSE2(__m128i chars)
+{
+	__m128i upper = _mm_subs_epu16(_mm_sub_epi16(chars, _mm_set1_epi16(L'A')), _mm_set1_epi16(L'Z' - L'A'));
+	return _mm_add_epi16(chars, _mm_and_si128(_mm_cmpeq_epi16(upper, _mm_setzero_si128()), _mm_set1_epi16(0x20)));
+}
+
+static inline bool HasNonAsciiSSE2(const wchar_t* chr, const wchar_t* end)
+{
+	__m128i bits = _mm_setzero_si128();
+	for(; chr + 8 <= end; chr += 8)
+		bits = _mm_or_si128(bits, _mm_loadu_si128((const __m128i*)chr));
+	if(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(bits, _mm_set1_epi16((short)0xff80)), _mm_setzero_si128())) != 0xffff)
+		return true;
+
+	for(; chr < end; ++chr)
+	{
+		if(*chr >= 0x80)
+			return true;
+	}
+
+	return false;
+}
+
+static inline const wchar_t* VerifyCandidatesNoCase(const SearchPattern& pattern, const wchar_t* text, const wchar_t* chr, unsigned int mask)
+{
+	while(mask)
+	{
+		unsigned long bit;
+		_BitScanForward(&bit, mask);
+		const wchar_t* candidate = chr + bit / 2;
+		if(MatchesAtNoCase(pattern, text, candidate))
+			return candidate;
+		mask &= ~(3u << bit);
+	}
+
+	return 0;
+}
+
+// Does the work of FindTextNoCaseSSE2() once the range is known to be all ASCII.
+static const wchar_t* FindAsciiNoCaseSSE2(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end)
+{
+	unsigned int length = pattern.length;
+	const wchar_t* chr = start;
+	if(pattern.wholeWord && (chr == text) && (chr < end))
+	{
+		if(MatchesAtNoCase(pattern, text, chr))
+			return chr;
+		++chr;
+	}
+
+	__m128i first = _mm_set1_epi16(pattern.folded[0]);
+	__m128i last = _mm_set1_epi16(pattern.folded[length - 1]);
+	for(; chr + 8 + length <= end; chr += 8)
+	{
+		__m128i hits = _mm_and_si128(_mm_cmpeq_epi16(FoldAsciiSSE2(_mm_loadu_si128((const __m128i*)chr)), first),
+			_mm_cmpeq_epi16(FoldAsciiSSE2(_mm_loadu_si128((const __m128i*)(chr + length - 1))), last));
+		if(pattern.wholeWord)
+		{
+			hits = _mm_andnot_si128(IsIdCharSSE2(_mm_loadu_si128((const __m128i*)(chr - 1))), hits);
+			hits = _mm_andnot_si128(IsIdCharSSE2(_mm_loadu_si128((const __m128i*)(chr + length))), hits);
+		}
+
+		unsigned int mask = _mm_movemask_epi8(hits);
+		if(mask)
+		{
+			const wchar_t* match = VerifyCandidatesNoCase(pattern, text, chr, mask);
+			if(match)
+				return match;
+		}
+	}
+
+	for(; chr + 8 <= end; chr += 8)
+	{
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(FoldAsciiSSE2(_mm_loadu_si128((const __m128i*)chr)), first));
+		if(mask)
+		{
+			const wchar_t* match = VerifyCandidatesNoCase(pattern, text, chr, mask);
+			if(match)
+				return match;
+		}
+	}
+
+	for(; chr < end; ++chr)
+	{
+		if( (FoldAscii(*chr) == pattern.folded[0]) && MatchesAtNoCase(pattern, text, chr) )
+			return chr;
+	}
+
+	return 0;
+}
+
+const wchar_t* FindTextNoCaseSSE2(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end)
+{
+	if(pattern.folded.empty() || HasNonAsciiSSE2(start, end))
+		return FindTextNoCasePlainC(pattern, text, start, end);
+	return FindAsciiNoCaseSSE2(pattern, text, start, end);
+}
+
+#if _MSC_VER >= 1700
+
+static inline __m256i FoldAsciiAVX2(__m256i chars)
+{
+	__m256i upper = _mm256_subs_epu16(_mm256_sub_epi16(chars, _mm256_set1_epi16(L'A')), _mm256_set1_epi16(L'Z' - L'A'));
+	return _mm256_add_epi16(chars, _mm256_and_si256(_mm256_cmpeq_epi16(upper, _mm256_setzero_si256()), _mm256_set1_epi16(0x20)));
+}
+
+static inline bool HasNonAsciiAVX2(const wchar_t* chr, const wchar_t* end)
+{
+	__m256i bits = _mm256_setzero_si256();
+	for(; chr + 16 <= end; chr += 16)
+		bits = _mm256_or_si256(bits, _mm256_loadu_si256((const __m256i*)chr));
+	if(!_mm256_testz_si256(bits, _mm256_set1_epi16((short)0xff80)))
+		return true;
+	return HasNonAsciiSSE2(chr, end);
+}
+
+const wchar_t* FindTextNoCaseAVX2(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end)
+{
+	if(pattern.folded.empty() || HasNonAsciiAVX2(start, end))
+		return FindTextNoCasePlainC(pattern, text, start, end);
+
+	unsigned int length = pattern.length;
+	const wchar_t* chr = start;
+	if(pattern.wholeWord && (chr == text) && (chr < end))
+	{
+		if(MatchesAtNoCase(pattern, text, chr))
+			return chr;
+		++chr;
+	}
+
+	__m256i first = _mm256_set1_epi16(pattern.folded[0]);
+	__m256i last = _mm256_set1_epi16(pattern.folded[length - 1]);
+	for(; chr + 16 + length <= end; chr += 16)
+	{
+		__m256i hits = _mm256_and_si256(_mm256_cmpeq_epi16(FoldAsciiAVX2(_mm256_loadu_si256((const __m256i*)chr)), first),
+			_mm256_cmpeq_epi16(FoldAsciiAVX2(_mm256_loadu_si256((const __m256i*)(chr + length - 1))), last));
+		if(pattern.wholeWord)
+		{
+			hits = _mm256_andnot_si256(IsIdCharAVX2(_mm256_loadu_si256((const __m256i*)(chr - 1))), hits);
+			hits = _mm256_andnot_si256(IsIdCharAVX2(_mm256_loadu_si256((const __m256i*)(chr + length))), hits);
+		}
+
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(hits);
+		if(mask)
+		{
+			const wchar_t* match = VerifyCandidatesNoCase(pattern, text, chr, mask);
+			if(match)
+				return match;
+		}
+	}
+
+	return FindAsciiNoCaseSSE2(pattern, text, chr, end);
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+
+#pragma once
+
+// A word to search for, along with the options of the search.
+struct SearchPattern
+{
+	SearchPattern(const wchar_t* word_, unsigned int length_, bool wholeWord_);
+
+	const wchar_t*			word;
+	unsigned int			length;
+	// Only match the word if it's not preceded or followed by an identifier character.
+	bool					wholeWord;
+	// The word with its ASCII letters in lower case, for the case insensitive kernels. Empty if the word has
+	// characters outside ASCII, which only the CRT knows how to fold.
+	std::vector<wchar_t>	folded;
+};
+
+// Find the first position in [start, end) where the pattern begins, or return 0 if there's none. The word may extend
+// past the end of the range, but the text must be null-terminated. Text is the beginning of the whole text, so that
+// whole word searches know when there's no character before the start of the range.
+const wchar_t* FindTextPlainC(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end);
+const wchar_t* FindTextSSE2(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end);
+#if _MSC_VER >= 1700
+const wchar_t* FindTextAVX2(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end);
+#endif
+// The case insensitive kernels match what _wcsnicmp() does. The vector versions fold ASCII letters themselves, and
+// fall back to the plain C loop for ranges with characters outside ASCII.
+const wchar_t* FindTextNoCasePlainC(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end);
+const wchar_t* FindTextNoCaseSSE2(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end);
+#if _MSC_VER >= 1700
+const wchar_t* FindTextNoCaseAVX2(const SearchPattern& pattern, const wchar_t* text, const wchar_t* start, const wchar_t* end);
+#endif
@@ -16,176 +16,454 @@
 
 #include "MetalScrollPCH.h"
 #include "Utils.h"
+#include "CpuDispatch.h"
 
-static bool g_hasSSE2 = false;
+void ExpandPalettePlainC(unsigned int* dest, const unsigned char* src, int count, const unsigned int* palette, int /*numColors*/)
+{
+	for(int i = 0; i < count; ++i)
+		dest[i] = palette[src[i]];
+}
 
-static void FlipScaleImagePlainC(unsigned int* dest, int destHeight, const unsigned int* src, int srcHeight, int width)
+void ExpandPaletteSSE41(unsigned int* dest, const unsigned char* src, int count, const unsigned int* palette, int numColors)
 {
-	float yaspect = 1.0f * srcHeight / destHeight;
-	float invAspect = 1.0f / yaspect;
-	float lowY = 0.0f;
+	if(numColors > 16)
+	{
+		ExpandPalettePlainC(dest, src, count, palette, numColors);
+		return;
+	}
 
-	// Also flip the image.
-	dest = dest + destHeight*width;
+	// Split the palette into byte planes, so that looking up one channel of 16 pixels is a single shuffle.
+	unsigned char planeBytes[4][16];
+	memset(planeBytes, 0, sizeof(planeBytes));
+	for(int c = 0; c < numColors; ++c)
+	{
+		for(int k = 0; k < 4; ++k)
+			planeBytes[k][c] = (unsigned char)(palette[c] >> (k*8));
+	}
+
+	__m128i planes[4];
+	for(int k = 0; k < 4; ++k)
+		planes[k] = _mm_loadu_si128((const __m128i*)planeBytes[k]);
 
-	for(int i = 0; i < destHeight; ++i)
+	int i = 0;
+	for(; i + 16 <= count; i += 16)
 	{
-		dest -= width;
-		unsigned char* destPixel = (unsigned char*)dest;
+		__m128i indices = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i b = _mm_shuffle_epi8(planes[0], indices);
+		__m128i g = _mm_shuffle_epi8(planes[1], indices);
+		__m128i r = _mm_shuffle_epi8(planes[2], indices);
+		__m128i a = _mm_shuffle_epi8(planes[3], indices);
+
+		// Interleave the planes back into BGRA pixels.
+		__m128i bgLow = _mm_unpacklo_epi8(b, g);
+		__m128i bgHigh = _mm_unpackhi_epi8(b, g);
+		__m128i raLow = _mm_unpacklo_epi8(r, a);
+		__m128i raHigh = _mm_unpackhi_epi8(r, a);
+		__m128i* pixels = (__m128i*)(dest + i);
+		_mm_storeu_si128(pixels, _mm_unpacklo_epi16(bgLow, raLow));
+		_mm_storeu_si128(pixels + 1, _mm_unpackhi_epi16(bgLow, raLow));
+		_mm_storeu_si128(pixels + 2, _mm_unpacklo_epi16(bgHigh, raHigh));
+		_mm_storeu_si128(pixels + 3, _mm_unpackhi_epi16(bgHigh, raHigh));
+	}
+
+	ExpandPalettePlainC(dest + i, src + i, count - i, palette, numColors);
+}
 
-		float highY = lowY + yaspect;
-		if(highY > srcHeight)
+void BlendCursorPlainC(unsigned int* pixels, int count, unsigned int cursorColor)
+{
+	unsigned char opacity = (unsigned char)(cursorColor >> 24);
+	unsigned char color[3] =
+	{
+		cursorColor & 0xff,
+		(cursorColor >> 8) & 0xff,
+		(cursorColor >> 16) & 0xff
+	};
+
+	unsigned char* pixel = (unsigned char*)pixels;
+	unsigned char* end = pixel + count*4;
+	for(; pixel < end; pixel += 4)
+	{
+		for(int i = 0; i < 3; ++i)
 		{
-			// If the averaging kernel exceeds the source image height, clamp the kernel.
-			highY = (float)srcHeight;
-			invAspect = 1.0f / (highY - lowY);
+			int p = (opacity*pixel[i])/255 + color[i];
+			pixel[i] = (p <= 255) ? (unsigned char)p : 255;
 		}
+	}
+}
+
+// The SIMD blends work on 16 bit channels. The alpha channel is multiplied by 255 and gets nothing added, so it
+// comes out unchanged. For products of two bytes, (x*0x8081) >> 23 is exactly x/255, which is what the plain C
+// version computes, and the saturating add does the clamping.
+static inline __m128i BlendCursorChannels(__m128i channels, __m128i opacity)
+{
+	__m128i products = _mm_mullo_epi16(channels, opacity);
+	return _mm_srli_epi16(_mm_mulhi_epu16(products, _mm_set1_epi16((short)0x8081)), 7);
+}
+
+void BlendCursorSSE2(unsigned int* pixels, int count, unsigned int cursorColor)
+{
+	short opacity = (short)(cursorColor >> 24);
+	__m128i opacities = _mm_setr_epi16(opacity, opacity, opacity, 255, opacity, opacity, opacity, 255);
+	__m128i color = _mm_set1_epi32(cursorColor & 0xffffff);
+	__m128i zero = _mm_setzero_si128();
 
-		int srcStartY = (int)lowY;
-		const unsigned char* srcLineStart = (unsigned char*)(src + srcStartY*width);
+	int i = 0;
+	for(; i + 4 <= count; i += 4)
+	{
+		__m128i* p = (__m128i*)(pixels + i);
+		__m128i fourPixels = _mm_loadu_si128(p);
+		__m128i low = BlendCursorChannels(_mm_unpacklo_epi8(fourPixels, zero), opacities);
+		__m128i high = BlendCursorChannels(_mm_unpackhi_epi8(fourPixels, zero), opacities);
+		_mm_storeu_si128(p, _mm_adds_epu8(_mm_packus_epi16(low, high), color));
+	}
 
-		// Compute the weights for the first and last pixel.
-		float truncLowY = (float)srcStartY;
-		float firstPixelArea = 1.0f - (lowY - truncLowY);
-		float lastPixelArea = highY - (float)(int)highY;
-		if(lastPixelArea == 0.0f)
-			lastPixelArea = 1.0f;
+	BlendCursorPlainC(pixels + i, count - i, cursorColor);
+}
 
-		for(int j = 0; j < width; ++j)
+// Row kernels of the palette scaler. Palette colors and accumulated pixels are 4 floats each; the plain C versions
+// only use the first 3, and leave the alpha of the destination pixels alone.
+void ScaleStartRowPlainC(float* accum, const unsigned char* src, int width, const float* palette, float area)
+{
+	for(int j = 0; j < width; ++j)
+	{
+		const float* color = palette + src[j]*4;
+		for(int k = 0; k < 3; ++k)
+			accum[j*4 + k] = color[k] * area;
+	}
+}
+
+void ScaleAddRowPlainC(float* accum, const unsigned char* src, int width, const float* palette)
+{
+	for(int j = 0; j < width; ++j)
+	{
+		const float* color = palette + src[j]*4;
+		for(int k = 0; k < 3; ++k)
+			accum[j*4 + k] += color[k];
+	}
+}
+
+void ScaleFinishRowPlainC(unsigned int* dest, const float* accum, const unsigned char* src, int width, const float* palette, float area, float invArea)
+{
+	unsigned char* destPixel = (unsigned char*)dest;
+	for(int j = 0; j < width; ++j)
+	{
+		const float* color = palette + src[j]*4;
+		for(int k = 0; k < 3; ++k)
 		{
-			float pixel[3] = { 0.0f };
-
-			const unsigned char* srcPixel = srcLineStart + j*4;
-
-			// First pixel.
-			for(int k = 0; k < 3; ++k)
-				pixel[k] += srcPixel[k] * firstPixelArea;
-			srcPixel += width*4;
-
-			// Whole pixels. For some reason, it's faster to iterate with a float than using srcStartY and
-			// casting highY to int outside the loop.
-			float y = truncLowY + 1.0f;
-			while(y < highY - 1)
-			{
-				for(int k = 0; k < 3; ++k)
-					pixel[k] += srcPixel[k];
-				++y;
-				srcPixel += width*4;
-			}
-
-			// Last pixel.
-			for(int k = 0; k < 3; ++k)
-				pixel[k] += srcPixel[k] * lastPixelArea;
-
-			// Divide by area.
-			for(int k = 0; k < 3; ++k)
-				destPixel[k] = (unsigned char)((int)(pixel[k] * invAspect));
-			destPixel += 4;
+			float pixel = accum[j*4 + k] + color[k] * area;
+			destPixel[k] = (unsigned char)((int)(pixel * invArea));
 		}
+		destPixel += 4;
+	}
+}
+
+void ScaleStartRowSSE(float* accum, const unsigned char* src, int width, const float* palette, float area)
+{
+	__m128* accumPixels = (__m128*)accum;
+	const __m128* colors = (const __m128*)palette;
+	__m128 pixelArea = _mm_load1_ps(&area);
+	for(int j = 0; j < width; ++j)
+		accumPixels[j] = _mm_mul_ps(colors[src[j]], pixelArea);
+}
+
+void ScaleAddRowSSE(float* accum, const unsigned char* src, int width, const float* palette)
+{
+	__m128* accumPixels = (__m128*)accum;
+	const __m128* colors = (const __m128*)palette;
+	for(int j = 0; j < width; ++j)
+		accumPixels[j] = _mm_add_ps(colors[src[j]], accumPixels[j]);
+}
 
-		lowY += yaspect;
+void ScaleFinishRowSSE(unsigned int* dest, const float* accum, const unsigned char* src, int width, const float* palette, float area, float invArea)
+{
+	const __m128* accumPixels = (const __m128*)accum;
+	const __m128* colors = (const __m128*)palette;
+	__m128 pixelArea = _mm_load1_ps(&area);
+	__m128 invPixelArea = _mm_load1_ps(&invArea);
+	for(int j = 0; j < width; ++j)
+	{
+		__m128 accumPixel = _mm_add_ps(_mm_mul_ps(colors[src[j]], pixelArea), accumPixels[j]);
+		accumPixel = _mm_mul_ps(accumPixel, invPixelArea);
+		__m128i intPixel = _mm_cvtps_epi32(accumPixel);
+		intPixel = _mm_packs_epi32(intPixel, intPixel);
+		intPixel = _mm_packus_epi16(intPixel, intPixel);
+		dest[j] = _mm_cvtsi128_si32(intPixel);
 	}
 }
 
-static __m128 LoadPixel(unsigned int p)
+// Fixed point kernels. Accumulated channels are 32 bits with FIXED_POINT_BITS fractional bits, and the palette is
+// premultiplied by the weight of the row, so adding a row is just a lookup and an add. The weights of a destination
+// row add up to one, so the sums can't overflow. The accumulator holds blocks of 8 pixels as 4 registers, one per
+// channel, and the palette is split the same way, with one register of MAX_PALETTE_COLORS (8) entries per channel.
+// That way looking up a channel of 8 pixels is a single permute, and a whole row goes through in 8 pixel steps.
+#define FIXED_POINT_BITS			24
+#define FIXED_POINT_BLOCK			8
+
+static void WeightPalette(unsigned int* dest, const unsigned int* palette, int numColors, double weight)
 {
-	__m128i intPixel = _mm_cvtsi32_si128(p);
-	__m128i zero = _mm_setzero_si128();
-	intPixel = _mm_unpacklo_epi8(intPixel, zero);
-	intPixel = _mm_unpacklo_epi16(intPixel, zero);
-	return _mm_cvtepi32_ps(intPixel);
+	double scale = weight * (1 << FIXED_POINT_BITS);
+	memset(dest, 0, MAX_PALETTE_COLORS*4*sizeof(unsigned int));
+	for(int c = 0; c < numColors; ++c)
+	{
+		for(int k = 0; k < 4; ++k)
+			dest[k*MAX_PALETTE_COLORS + c] = (unsigned int)(((palette[c] >> (k*8)) & 0xff) * scale + 0.5);
+	}
 }
 
-static void FlipScaleImageSSE(unsigned int* dest, int destHeight, const unsigned int* src, int srcHeight, int width)
+#if _MSC_VER >= 1700
+
+// Same as the SSE2 version, 8 pixels at a time. Unpacking and packing both work within 128 bit lanes, so the pixels
+// come out in the order they went in.
+void BlendCursorAVX2(unsigned int* pixels, int count, unsigned int cursorColor)
 {
-	float yaspect = 1.0f * srcHeight / destHeight;
-	float lowY = 0.0f;
+	short opacity = (short)(cursorColor >> 24);
+	__m256i opacities = _mm256_setr_epi16(opacity, opacity, opacity, 255, opacity, opacity, opacity, 255,
+		opacity, opacity, opacity, 255, opacity, opacity, opacity, 255);
+	__m256i color = _mm256_set1_epi32(cursorColor & 0xffffff);
+	__m256i divisor = _mm256_set1_epi16((short)0x8081);
+	__m256i zero = _mm256_setzero_si256();
+
+	int i = 0;
+	for(; i + 8 <= count; i += 8)
+	{
+		__m256i* p = (__m256i*)(pixels + i);
+		__m256i eightPixels = _mm256_loadu_si256(p);
+		__m256i low = _mm256_mullo_epi16(_mm256_unpacklo_epi8(eightPixels, zero), opacities);
+		__m256i high = _mm256_mullo_epi16(_mm256_unpackhi_epi8(eightPixels, zero), opacities);
+		low = _mm256_srli_epi16(_mm256_mulhi_epu16(low, divisor), 7);
+		high = _mm256_srli_epi16(_mm256_mulhi_epu16(high, divisor), 7);
+		_mm256_storeu_si256(p, _mm256_adds_epu8(_mm256_packus_epi16(low, high), color));
+	}
 
-	float invAspectTmp = 1.0f / yaspect;
-	__m128 invAspect = _mm_load1_ps(&invAspectTmp);
+	BlendCursorSSE2(pixels + i, count - i, cursorColor);
+}
 
-	// Also flip the image.
-	dest = dest + destHeight*width;
+// The palette indices of the 8 pixels starting at column j, widened to 32 bits. Past the end of the row, the
+// indices are 0; those pixels are never written out.
+static inline __m256i LoadIndices(const unsigned char* src, int j, int width)
+{
+	if(j + FIXED_POINT_BLOCK <= width)
+		return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + j)));
 
-	for(int i = 0; i < destHeight; ++i)
+	unsigned char tail[FIXED_POINT_BLOCK] = { 0 };
+	memcpy(tail, src + j, width - j);
+	return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)tail));
+}
+
+// The accumulator and the palette must be 32 byte aligned.
+void FixedScaleStartRowAVX2(unsigned int* accum, const unsigned char* src, int width, const unsigned int* palette)
+{
+	__m256i* channels = (__m256i*)accum;
+	const __m256i* colors = (const __m256i*)palette;
+	for(int j = 0; j < width; j += FIXED_POINT_BLOCK, channels += 4)
+	{
+		__m256i indices = LoadIndices(src, j, width);
+		for(int k = 0; k < 4; ++k)
+			channels[k] = _mm256_permutevar8x32_epi32(colors[k], indices);
+	}
+
+	_mm256_zeroupper();
+}
+
+void FixedScaleAddRowAVX2(unsigned int* accum, const unsigned char* src, int width, const unsigned int* palette)
+{
+	__m256i* channels = (__m256i*)accum;
+	const __m256i* colors = (const __m256i*)palette;
+	for(int j = 0; j < width; j += FIXED_POINT_BLOCK, channels += 4)
+	{
+		__m256i indices = LoadIndices(src, j, width);
+		for(int k = 0; k < 4; ++k)
+			channels[k] = _mm256_add_epi32(_mm256_permutevar8x32_epi32(colors[k], indices), channels[k]);
+	}
+
+	_mm256_zeroupper();
+}
+
+void FixedScaleFinishRowAVX2(unsigned int* dest, const unsigned int* accum, const unsigned char* src, int width, const unsigned int* palette)
+{
+	const __m256i* channels = (const __m256i*)accum;
+	const __m256i* colors = (const __m256i*)palette;
+	__m256i half = _mm256_set1_epi32(1 << (FIXED_POINT_BITS - 1));
+	for(int j = 0; j < width; j += FIXED_POINT_BLOCK, channels += 4)
 	{
-		dest -= width;
-		unsigned int* destPixel = dest;
+		// Round, drop the fractional bits and put the channels back together. The weights add up to one, so
+		// every channel fits in a byte.
+		__m256i indices = LoadIndices(src, j, width);
+		__m256i pixels = _mm256_setzero_si256();
+		for(int k = 0; k < 4; ++k)
+		{
+			__m256i sum = _mm256_add_epi32(_mm256_permutevar8x32_epi32(colors[k], indices), channels[k]);
+			sum = _mm256_srli_epi32(_mm256_add_epi32(sum, half), FIXED_POINT_BITS);
+			pixels = _mm256_or_si256(pixels, _mm256_slli_epi32(sum, k*8));
+		}
+
+		if(j + FIXED_POINT_BLOCK <= width)
+			_mm256_storeu_si256((__m256i*)(dest + j), pixels);
+		else
+		{
+			unsigned int tail[FIXED_POINT_BLOCK];
+			_mm256_storeu_si256((__m256i*)tail, pixels);
+			memcpy(dest + j, tail, (width - j)*sizeof(unsigned int));
+		}
+	}
 
-		float highY = lowY + yaspect;
-		if(highY > srcHeight)
+	_mm256_zeroupper();
+}
+
+#endif
+
+PaletteScaler::PaletteScaler(unsigned int* dest, int destHeight, int srcHeight, int width, const unsigned int* palette, int numColors)
+{
+	// Also flip the image.
+	m_dest = dest + destHeight*width;
+	m_destHeight = destHeight;
+	m_srcHeight = srcHeight;
+	m_width = width;
+
+	m_nextDestRow = 0;
+	m_srcRow = 0;
+	m_yaspect = 1.0 * srcHeight / destHeight;
+
+	// Past MAX_FIXED_POINT_ASPECT rows per pixel, the rounding of the weights would show.
+	m_fixedPoint = g_kernels.fixedScaleStartRow && (m_yaspect <= MAX_FIXED_POINT_ASPECT) && (numColors <= MAX_PALETTE_COLORS);
+	if(m_fixedPoint)
+	{
+		m_numColors = numColors;
+		std::copy(palette, palette + numColors, m_colors);
+
+		// The first row palette, the whole and last row palettes of the two destination rows which can be in
+		// progress at the same time, and their accumulators, padded to whole blocks of pixels.
+		int paletteSize = MAX_PALETTE_COLORS*4;
+		int accumSize = ((width + FIXED_POINT_BLOCK - 1) & ~(FIXED_POINT_BLOCK - 1))*4;
+		m_fixedStorage.resize(paletteSize*5 + accumSize*2 + 8);
+		unsigned int* storage = (unsigned int*)(((UINT_PTR)&m_fixedStorage[0] + 31) & ~(UINT_PTR)31);
+		for(int i = 0; i < 2; ++i)
 		{
-			// If the averaging kernel exceeds the source image height, clamp the kernel.
-			highY = (float)srcHeight;
-			float invArea = 1.0f / (highY - lowY);
-			invAspect = _mm_load1_ps(&invArea);
+			m_rows[i].destRow = -1;
+			m_rows[i].fixedAccum = storage + i*accumSize;
+			m_rows[i].wholePalette = storage + accumSize*2 + i*paletteSize*2;
+			m_rows[i].lastPalette = m_rows[i].wholePalette + paletteSize;
 		}
+		m_firstPalette = storage + accumSize*2 + paletteSize*4;
+		return;
+	}
 
-		int srcStartY = (int)lowY;
-		const unsigned int* srcLineStart = src + srcStartY*width;
+	// One float vector per palette entry, followed by the accumulators for the two destination rows which can be
+	// in progress at the same time. std::vector doesn't align its storage, so align the pointers by hand.
+	m_storage.resize((numColors + 2*width)*4 + 4);
+	m_palette = (float*)(((UINT_PTR)&m_storage[0] + 15) & ~(UINT_PTR)15);
+	for(int c = 0; c < numColors; ++c)
+	{
+		for(int k = 0; k < 4; ++k)
+			m_palette[c*4 + k] = (float)((palette[c] >> (k*8)) & 0xff);
+	}
+
+	for(int i = 0; i < 2; ++i)
+	{
+		m_rows[i].destRow = -1;
+		m_rows[i].accum = m_palette + (numColors + i*width)*4;
+	}
+}
+
+void PaletteScaler::AddRow(const unsigned char* src)
+{
+	int y = m_srcRow++;
+	if(y >= m_srcHeight)
+		return;
 
-		// Compute the weights for the first and last pixel.
-		float truncLowY = (float)srcStartY;
-		float areaTmp = 1.0f - (lowY - truncLowY);
-		__m128 firstPixelArea = _mm_load1_ps(&areaTmp);
-		areaTmp = highY - (float)(int)highY;
-		if(areaTmp == 0.0f)
-			areaTmp = 1.0f;
-		__m128 lastPixelArea = _mm_load1_ps(&areaTmp);
+	// Add the row to the destination rows in progress, finishing the ones for which it's the last row.
+	for(int i = 0; i < 2; ++i)
+	{
+		DestRow& row = m_rows[i];
+		if(row.destRow < 0)
+			continue;
 
-		for(int j = 0; j < width; ++j)
+		if(y < row.lastSrcRow)
+			AccumulateRow(row, src);
+		else
 		{
-			__m128 accumPixel = _mm_setzero_ps();
-
-			const unsigned int* srcPixel = srcLineStart + j;
-
-			// First pixel.
-			__m128 fltPixel = LoadPixel(srcPixel[0]);
-			fltPixel = _mm_mul_ps(fltPixel, firstPixelArea);
-			accumPixel = _mm_add_ps(fltPixel, accumPixel);
-			srcPixel += width;
-
-			// Whole pixels.
-			float y = truncLowY + 1.0f;
-			while(y < highY - 1)
-			{
-				fltPixel = LoadPixel(srcPixel[0]);
-				accumPixel = _mm_add_ps(fltPixel, accumPixel);
-				++y;
-				srcPixel += width;
-			}
-
-			// Last pixel.
-			fltPixel = LoadPixel(srcPixel[0]);
-			fltPixel = _mm_mul_ps(fltPixel, lastPixelArea);
-			accumPixel = _mm_add_ps(fltPixel, accumPixel);
-
-			// Convert to 4 bytes.
-			accumPixel = _mm_mul_ps(accumPixel, invAspect);
-			__m128i intPixel = _mm_cvtps_epi32(accumPixel);
-			intPixel = _mm_packs_epi32(intPixel, intPixel);
-			intPixel = _mm_packus_epi16(intPixel, intPixel);
-			*destPixel =  _mm_cvtsi128_si32(intPixel);
-			++destPixel;
+			FinishRow(row, src);
+			row.destRow = -1;
 		}
+	}
+
+	// Start the next destination row if its kernel begins here. The source is taller than the destination, so
+	// at most one row can start on each source row, and the previous row ends before the one after it starts.
+	if( (m_nextDestRow >= m_destHeight) || ((m_rows[0].destRow >= 0) && (m_rows[1].destRow >= 0)) )
+		return;
+
+	// Compute the kernel position from the row number instead of adding up the aspect ratio, and do it in double
+	// precision. Far down tall images, float rounding errors are bigger than the fractional part of the aspect ratio,
+	// which makes kernels start on the wrong row.
+	double lowY = m_nextDestRow * m_yaspect;
+	if((int)lowY > y)
+		return;
+
+	DestRow& row = (m_rows[0].destRow < 0) ? m_rows[0] : m_rows[1];
+	row.destRow = m_nextDestRow++;
+
+	double highY = lowY + m_yaspect;
+	if(highY > m_srcHeight)
+	{
+		// If the averaging kernel exceeds the source image height, clamp the kernel.
+		highY = m_srcHeight;
+	}
+
+	// Compute the weights for the first and last row.
+	float firstPixelArea = (float)(1.0 - (lowY - y));
+	row.lastPixelArea = (float)(highY - (int)highY);
+	if(row.lastPixelArea == 0.0f)
+		row.lastPixelArea = 1.0f;
+
+	// Every row after the first one is a whole row, up to the first one which reaches the end of the kernel.
+	int lastY = y + 1;
+	while(lastY < highY - 1)
+		++lastY;
+	row.lastSrcRow = std::min(lastY, m_srcHeight - 1);
+
+	// Divide by the sum of the weights rather than by the aspect ratio. They're only equal up to rounding, and far
+	// down the image the difference is enough to push the fixed point sums past 8 bits.
+	float area = firstPixelArea + (float)(row.lastSrcRow - y - 1) + row.lastPixelArea;
+	row.invArea = 1.0f / area;
+
+	StartRow(row, src, firstPixelArea);
+}
 
-		lowY += yaspect;
+void PaletteScaler::StartRow(DestRow& row, const unsigned char* src, float firstPixelArea)
+{
+	if(m_fixedPoint)
+	{
+		WeightPalette(m_firstPalette, m_colors, m_numColors, (double)firstPixelArea * row.invArea);
+		WeightPalette(row.wholePalette, m_colors, m_numColors, row.invArea);
+		WeightPalette(row.lastPalette, m_colors, m_numColors, (double)row.lastPixelArea * row.invArea);
+		g_kernels.fixedScaleStartRow(row.fixedAccum, src, m_width, m_firstPalette);
 	}
+	else
+		g_kernels.scaleStartRow(row.accum, src, m_width, m_palette, firstPixelArea);
+}
+
+void PaletteScaler::AccumulateRow(DestRow& row, const unsigned char* src)
+{
+	if(m_fixedPoint)
+		g_kernels.fixedScaleAddRow(row.fixedAccum, src, m_width, row.wholePalette);
+	else
+		g_kernels.scaleAddRow(row.accum, src, m_width, m_palette);
 }
 
-void FlipScaleImageVertically(unsigned int* dest, int destHeight, const unsigned int* src, int srcHeight, int width)
+void PaletteScaler::FinishRow(DestRow& row, const unsigned char* src)
 {
-	if(g_hasSSE2)
-		FlipScaleImageSSE(dest, destHeight, src, srcHeight, width);
+	unsigned int* dest = m_dest - (row.destRow + 1)*m_width;
+	if(m_fixedPoint)
+		g_kernels.fixedScaleFinishRow(dest, row.fixedAccum, src, m_width, row.lastPalette);
 	else
-		FlipScaleImagePlainC(dest, destHeight, src, srcHeight, width);
+		g_kernels.scaleFinishRow(dest, row.accum, src, m_width, m_palette, row.lastPixelArea, row.invArea);
 }
 
-void InitScaler()
+void FlipScalePaletteImage(unsigned int* dest, int destHeight, const unsigned char* src, int srcHeight, int width, const unsigned int* palette, int numColors)
 {
-	int info[4];
-	__cpuid(info, 1);
-	g_hasSSE2 = (info[3] & (1 << 26)) != 0;
+	PaletteScaler scaler(dest, destHeight, srcHeight, width, palette, numColors);
+	for(int i = 0; i < srcHeight; ++i)
+		scaler.AddRow(src + i*width);
 }
 
 void Log(const char* fmt, ...)
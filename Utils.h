@@ -24,8 +24,86 @@ template<typename T> static inline int clamp(const T& x, const T& min, const T&
 	return (x < min) ? min : ((x > max) ? max : x);
 }
 
-void InitScaler();
-void FlipScaleImageVertically(unsigned int* dest, int destHeight, const unsigned int* src, int srcHeight, int width);
+#define MAX_PALETTE_COLORS			8
+#define MAX_FIXED_POINT_ASPECT		65536
+
+// Palette images have one byte per pixel, indexing a palette of ARGB colors. The expansion kernels are called
+// through the dispatch table.
+void ExpandPalettePlainC(unsigned int* dest, const unsigned char* src, int count, const unsigned int* palette, int numColors);
+void ExpandPaletteSSE41(unsigned int* dest, const unsigned char* src, int count, const unsigned int* palette, int numColors);
+// Scales a palette image down and flips it. The source must be taller than the destination.
+void FlipScalePaletteImage(unsigned int* dest, int destHeight, const unsigned char* src, int srcHeight, int width, const unsigned int* palette, int numColors);
+
+// Does the same thing as FlipScalePaletteImage() one source row at a time, so the source image doesn't have to be
+// kept in memory. Each destination row is written as soon as its last source row is added.
+class PaletteScaler
+{
+public:
+	PaletteScaler(unsigned int* dest, int destHeight, int srcHeight, int width, const unsigned int* palette, int numColors);
+	void							AddRow(const unsigned char* src);
+
+private:
+	struct DestRow
+	{
+		int							destRow;
+		int							lastSrcRow;
+		float						lastPixelArea;
+		float						invArea;
+		float*						accum;
+
+		// Fixed point kernel only. The palette premultiplied by the weights of the whole rows and the last row.
+		unsigned int*				fixedAccum;
+		unsigned int*				wholePalette;
+		unsigned int*				lastPalette;
+	};
+
+	unsigned int*					m_dest;
+	int								m_destHeight;
+	int								m_srcHeight;
+	int								m_width;
+	// Whether the rows go through the fixed point kernels rather than the float ones.
+	bool							m_fixedPoint;
+
+	std::vector<float>				m_storage;
+	float*							m_palette;
+	DestRow							m_rows[2];
+
+	std::vector<unsigned int>		m_fixedStorage;
+	unsigned int*					m_firstPalette;
+	unsigned int					m_colors[MAX_PALETTE_COLORS];
+	int								m_numColors;
+
+	int								m_nextDestRow;
+	int								m_srcRow;
+	double							m_yaspect;
+
+	void							StartRow(DestRow& row, const unsigned char* src, float firstPixelArea);
+	void							AccumulateRow(DestRow& row, const unsigned char* src);
+	void							FinishRow(DestRow& row, const unsigned char* src);
+};
+
+// Row kernels of the palette scaler, called through the dispatch table. The float kernels take a palette and
+// accumulators of 4 floats per pixel. The fixed point ones take palettes premultiplied by the row weights, split by
+// channel; see Utils.cpp. The AVX2 ones need 32 byte aligned accumulators and palettes.
+void ScaleStartRowPlainC(float* accum, const unsigned char* src, int width, const float* palette, float area);
+void ScaleAddRowPlainC(float* accum, const unsigned char* src, int width, const float* palette);
+void ScaleFinishRowPlainC(unsigned int* dest, const float* accum, const unsigned char* src, int width, const float* palette, float area, float invArea);
+void ScaleStartRowSSE(float* accum, const unsigned char* src, int width, const float* palette, float area);
+void ScaleAddRowSSE(float* accum, const unsigned char* src, int width, const float* palette);
+void ScaleFinishRowSSE(unsigned int* dest, const float* accum, const unsigned char* src, int width, const float* palette, float area, float invArea);
+#if _MSC_VER >= 1700
+void FixedScaleStartRowAVX2(unsigned int* accum, const unsigned char* src, int width, const unsigned int* palette);
+void FixedScaleAddRowAVX2(unsigned int* accum, const unsigned char* src, int width, const unsigned int* palette);
+void FixedScaleFinishRowAVX2(unsigned int* dest, const unsigned int* accum, const unsigned char* src, int width, const unsigned int* palette);
+#endif
+
+// Blends the page cursor over a run of pixels: each channel is scaled by the cursor alpha and the cursor color is
+// added on top, saturating.
+void BlendCursorPlainC(unsigned int* pixels, int count, unsigned int cursorColor);
+void BlendCursorSSE2(unsigned int* pixels, int count, unsigned int cursorColor);
+#if _MSC_VER >= 1700
+void BlendCursorAVX2(unsigned int* pixels, int count, unsigned int cursorColor);
+#endif
 
 void Log(const char* fmt, ...);
 
@@ -0,0 +1,248 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+
+#include "MetalScrollPCH.h"
+#include "WordMatcher.h"
+#include "CppLexer.h"
+#include "CpuDispatch.h"
+#include "TextSearch.h"
+#include "LineIndex.h"
+
+WordMatcher::WordMatcher(bool caseSensitive, bool wholeWord)
+{
+	m_refCount = 1;
+	m_caseSensitive = caseSensitive;
+	m_wholeWord = wholeWord;
+	m_hash = 0;
+	m_numClasses = 1;
+	m_hasLoneWords = false;
+}
+
+void WordMatcher::AddRef()
+{
+	InterlockedIncrement(&m_refCount);
+}
+
+void WordMatcher::Release()
+{
+	if(InterlockedDecrement(&m_refCount) == 0)
+		delete this;
+}
+
+void WordMatcher::AddWord(const wchar_t* word, unsigned int length, unsigned int id)
+{
+	Word newWord;
+	newWord.chars.assign(word, length);
+	newWord.id = id;
+	newWord.searchAlone = false;
+	if(!m_caseSensitive)
+	{
+		for(unsigned int i = 0; i < length; ++i)
+		{
+			if(word[i] >= 0x80)
+				newWord.searchAlone = true;
+		}
+	}
+
+	m_hasLoneWords |= newWord.searchAlone;
+	m_words.push_back(newWord);
+}
+
+void WordMatcher::Build()
+{
+	// Give each distinct character its own class. Without case sensitivity, both cases of an ASCII letter share one.
+	m_charClasses.assign(0x10000, 0);
+	m_numClasses = 1;
+	for(std::vector<Word>::const_iterator it = m_words.begin(); it != m_words.end(); ++it)
+	{
+		if(it->searchAlone)
+			continue;
+		for(std::wstring::const_iterator chr = it->chars.begin(); chr != it->chars.end(); ++chr)
+		{
+			unsigned short c = (unsigned short)*chr;
+			if(m_charClasses[c])
+				continue;
+
+			m_charClasses[c] = (unsigned short)m_numClasses;
+			if( !m_caseSensitive && (((c >= L'A') && (c <= L'Z')) || ((c >= L'a') && (c <= L'z'))) )
+				m_charClasses[c ^ 0x20] = (unsigned short)m_numClasses;
+			++m_numClasses;
+		}
+	}
+
+	// Build the trie in the state table. A zero entry means there's no child yet, since nothing goes back to the
+	// root while building it.
+	unsigned int numClasses = m_numClasses;
+	unsigned int numStates = 1;
+	m_transitions.assign(numClasses, 0);
+	std::vector<std::vector<unsigned int> > outputs(1);
+	for(unsigned int i = 0; i < m_words.size(); ++i)
+	{
+		if(m_words[i].searchAlone)
+			continue;
+		unsigned int state = 0;
+		const std::wstring& chars = m_words[i].chars;
+		for(std::wstring::const_iterator chr = chars.begin(); chr != chars.end(); ++chr)
+		{
+			unsigned int entry = state*numClasses + m_charClasses[(unsigned short)*chr];
+			if(!m_transitions[entry])
+			{
+				m_transitions[entry] = numStates++;
+				m_transitions.resize(numStates*numClasses, 0);
+				outputs.resize(numStates);
+			}
+			state = m_transitions[entry];
+		}
+		outputs[state].push_back(i);
+	}
+
+	// Go through the states breadth first, so that the failure state of each one is complete before it's needed.
+	// The missing transitions are copied from the failure state, which turns the trie into a state machine.
+	std::vector<unsigned int> fail(numStates, 0);
+	std::vector<unsigned int> queue;
+	queue.reserve(numStates);
+	for(unsigned int c = 0; c < numClasses; ++c)
+	{
+		if(m_transitions[c])
+			queue.push_back(m_transitions[c]);
+	}
+
+	for(size_t i = 0; i < queue.size(); ++i)
+	{
+		unsigned int state = queue[i];
+		unsigned int* row = &m_transitions[state*numClasses];
+		const unsigned int* failRow = &m_transitions[fail[state]*numClasses];
+		outputs[state].insert(outputs[state].end(), outputs[fail[state]].begin(), outputs[fail[state]].end());
+		for(unsigned int c = 0; c < numClasses; ++c)
+		{
+			if(row[c])
+			{
+				fail[row[c]] = failRow[c];
+				queue.push_back(row[c]);
+			}
+			else
+				row[c] = failRow[c];
+		}
+	}
+
+	m_outputStart.resize(numStates + 1);
+	m_outputWords.clear();
+	for(unsigned int state = 0; state < numStates; ++state)
+	{
+		m_outputStart[state] = (unsigned int)m_outputWords.size();
+		m_outputWords.insert(m_outputWords.end(), outputs[state].begin(), outputs[state].end());
+	}
+	m_outputStart[numStates] = (unsigned int)m_outputWords.size();
+
+	unsigned int options[] = { m_caseSensitive, m_wholeWord, (unsigned int)m_words.size() };
+	m_hash = g_kernels.hashBytes(options, sizeof(options), 0);
+	for(std::vector<Word>::const_iterator it = m_words.begin(); it != m_words.end(); ++it)
+	{
+		unsigned int header[] = { it->id, (unsigned int)it->chars.size() };
+		m_hash = g_kernels.hashBytes(header, sizeof(header), m_hash);
+		m_hash = g_kernels.hashBytes(it->chars.c_str(), (unsigned int)(it->chars.size() * sizeof(wchar_t)), m_hash);
+	}
+}
+
+void WordMatcher::FindMatches(const wchar_t* text, std::vector<Match>& matches) const
+{
+	if(m_words.empty())
+		return;
+
+	// Where the last accepted match of each word ends, so the next one can't overlap it.
+	std::vector<unsigned int> lastEnd(m_words.size(), 0);
+	const unsigned int* transitions = &m_transitions[0];
+	const unsigned short* charClasses = &m_charClasses[0];
+	unsigned int numClasses = m_numClasses;
+
+	unsigned int state = 0;
+	int line = 0;
+	const wchar_t* lineStart = text;
+	for(const wchar_t* chr = text; *chr; ++chr)
+	{
+		wchar_t c = *chr;
+		if( (c == L'\r') || (c == L'\n') )
+		{
+			// No word contains line breaks, so the automaton starts over. CRLF is a single line break.
+			if( (c == L'\n') || (chr[1] != L'\n') )
+			{
+				++line;
+				lineStart = chr + 1;
+			}
+			state = 0;
+			continue;
+		}
+
+		state = transitions[state*numClasses + charClasses[(unsigned short)c]];
+		unsigned int outputEnd = m_outputStart[state + 1];
+		for(unsigned int i = m_outputStart[state]; i < outputEnd; ++i)
+		{
+			unsigned int wordIdx = m_outputWords[i];
+			unsigned int length = (unsigned int)m_words[wordIdx].chars.size();
+			const wchar_t* start = chr + 1 - length;
+			unsigned int offset = (unsigned int)(start - text);
+			if(offset < lastEnd[wordIdx])
+				continue;
+			if( m_wholeWord && !(((start == text) || IsCppIdSeparator(start[-1])) && IsCppIdSeparator(chr[1])) )
+				continue;
+
+			lastEnd[wordIdx] = offset + length;
+			Match match;
+			match.line = line;
+			match.start = (unsigned int)(start - lineStart);
+			match.end = match.start + length;
+			match.id = m_words[wordIdx].id;
+			matches.push_back(match);
+		}
+	}
+
+	if(m_hasLoneWords)
+		FindLoneWords(text, matches);
+}
+
+void WordMatcher::FindLoneWords(const wchar_t* text, std::vector<Match>& matches) const
+{
+	// The same line by line search as the one for the highlighted word, so both agree on what matches.
+	LineIndex lineIndex;
+	lineIndex.Build(text);
+	for(std::vector<Word>::const_iterator it = m_words.begin(); it != m_words.end(); ++it)
+	{
+		if(!it->searchAlone)
+			continue;
+
+		unsigned int length = (unsigned int)it->chars.size();
+		SearchPattern pattern(it->chars.c_str(), length, m_wholeWord);
+		for(int line = 0; line < lineIndex.GetNumLines(); ++line)
+		{
+			const wchar_t* lineStart = lineIndex.GetLineStart(line);
+			const wchar_t* lineEnd = lineStart + lineIndex.GetLineLength(line);
+			for(const wchar_t* chr = lineStart; ; chr += length)
+			{
+				chr = g_kernels.findTextNoCase(pattern, text, chr, lineEnd);
+				if(!chr)
+					break;
+
+				Match match;
+				match.line = line;
+				match.start = (unsigned int)(chr - lineStart);
+				match.end = match.start + length;
+				match.id = it->id;
+				matches.push_back(match);
+			}
+		}
+	}
+}
@@ -0,0 +1,97 @@
+/*
+*	Copyright 2009 Griffin Software
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License. 
+*/
+
+
+#pragma once
+
+// Finds the occurrences of a set of words in a single pass over the text, using an Aho-Corasick automaton turned
+// into a state table. Characters which don't appear in any word share one column of the table, so its size only
+// depends on the words. Matches follow the same rules as the word highlighting search: for each word, they're the
+// leftmost non-overlapping ones, and whole word matches can't touch identifier characters. The automaton only folds
+// ASCII letters, so without case sensitivity, words with other characters are searched for on their own with
+// the findTextNoCase kernel, like the highlighted word. Words can't contain line breaks. Matchers are reference
+// counted and not modified after Build(), so the UI thread can hand them to the render thread.
+class WordMatcher
+{
+public:
+	struct Match
+	{
+		int							line;
+		unsigned int				start;
+		unsigned int				end;
+		unsigned int				id;
+
+		// Matches of different words can start at the same place; the lower id goes first, so the order doesn't
+		// depend on the sort.
+		bool operator<(const Match& other) const
+		{
+			if(line != other.line)
+				return line < other.line;
+			if(start != other.start)
+				return start < other.start;
+			return id < other.id;
+		}
+	};
+
+	WordMatcher(bool caseSensitive, bool wholeWord);
+
+	void							AddRef();
+	void							Release();
+
+	void							AddWord(const wchar_t* word, unsigned int length, unsigned int id);
+	void							Build();
+
+	// Appends the matches in the text. Columns are relative to the line start. The matches found by the automaton
+	// come first, in the order in which they end, followed by those of the words searched for on their own.
+	void							FindMatches(const wchar_t* text, std::vector<Match>& matches) const;
+
+	bool							IsCaseSensitive() const { return m_caseSensitive; }
+	bool							IsWholeWord() const { return m_wholeWord; }
+	// A hash of the words, their ids and the options, so that snapshot fingerprints can tell matchers apart.
+	unsigned __int64				GetHash() const { return m_hash; }
+
+private:
+	struct Word
+	{
+		std::wstring				chars;
+		unsigned int				id;
+		// Searched for on its own instead of being part of the automaton.
+		bool						searchAlone;
+	};
+
+	volatile LONG					m_refCount;
+	bool							m_caseSensitive;
+	bool							m_wholeWord;
+	unsigned __int64				m_hash;
+
+	std::vector<Word>				m_words;
+	// The column of each character in the state table. Column 0 is for the characters which aren't in any word.
+	std::vector<unsigned short>		m_charClasses;
+	unsigned int					m_numClasses;
+	// The next state for each state and character class; state 0 is the root.
+	std::vector<unsigned int>		m_transitions;
+	// The words ending at each state, including the ones inherited through the failure links, as a range of
+	// indices into m_outputWords.
+	std::vector<unsigned int>		m_outputStart;
+	std::vector<unsigned int>		m_outputWords;
+	bool							m_hasLoneWords;
+
+	void							FindLoneWords(const wchar_t* text, std::vector<Match>& matches) const;
+
+	~WordMatcher() {}
+	WordMatcher(const WordMatcher&);
+	WordMatcher&					operator=(const WordMatcher&);
+};